@@ -0,0 +1,73 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "analysisframe.h"
+
+#include <QMutexLocker>
+
+namespace {
+    // Frames in the pool: three for the writer, the latest frame and the
+    // analysis it updates, and the rest for readers holding older frames
+    const int PoolSize = 6;
+}
+
+AnalysisFrameSlot::AnalysisFrameSlot()
+    : m_latest(-1)
+    , m_published(0)
+{
+    for (int i = 0; i < PoolSize; ++i)
+        m_frames << QExplicitlySharedDataPointer<AnalysisFrame>(new AnalysisFrame);
+}
+
+SharedAnalysisFrame AnalysisFrameSlot::latest() const
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_latest < 0)
+        return SharedAnalysisFrame();
+    return SharedAnalysisFrame(m_frames.at(m_latest).data());
+}
+
+AnalysisFrame *AnalysisFrameSlot::beginWrite()
+{
+    // Readers only take new references to the latest frame, under the lock,
+    // so a frame that only the pool refers to stays free
+    QMutexLocker lock(&m_mutex);
+    AnalysisFrame *oldest = nullptr;
+    for (int i = 0; i < m_frames.size(); ++i) {
+        AnalysisFrame *frame = m_frames[i].data();
+        if (i != m_latest && frame->ref.loadAcquire() == 1 && (!oldest || frame->m_sequence < oldest->m_sequence))
+            oldest = frame;
+    }
+    // An update lets go of the analysis it referred to
+    if (oldest)
+        oldest->m_analysis.reset();
+    return oldest;
+}
+
+void AnalysisFrameSlot::publish(AnalysisFrame *frame)
+{
+    QMutexLocker lock(&m_mutex);
+    for (int i = 0; i < m_frames.size(); ++i) {
+        if (m_frames.at(i).data() == frame) {
+            frame->m_sequence = ++m_published;
+            m_latest = i;
+            return;
+        }
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ANALYSISFRAME_H
+#define ANALYSISFRAME_H
+
+#include "spectrum.h"
+#include "tone.h"
+
+#include <QtGlobal>
+#include <QExplicitlySharedDataPointer>
+#include <QMutex>
+#include <QSharedData>
+#include <QVector>
+
+class AnalysisFrame;
+// A published frame, shared by its readers, which cannot change it
+using SharedAnalysisFrame = QExplicitlySharedDataPointer<const AnalysisFrame>;
+
+/* Results of one analysis, as published by the Analyzer.
+ *
+ * A full analysis carries the spectrum and autocorrelation of its segment. A
+ * fast update only refines the harmonics and refers to the full analysis it
+ * updates for the rest, so publishing it copies no spectra.
+ */
+class AnalysisFrame : public QSharedData
+{
+public:
+    // The fundamental first, then the harmonics found with it
+    const QVector<Tone> &harmonics() const { return m_harmonics; }
+    const Spectrum &spectrum() const { return source().m_spectrum; }
+    // The SNAC function and the peak chosen in it
+    const Spectrum &autocorrelation() const { return source().m_autocorrelation; }
+    const QVector<Tone> &snacPeaks() const { return source().m_snacPeaks; }
+    bool isUpdate() const { return m_analysis; }
+    // Number of the frame in the order of publication, counting from one
+    quint64 sequence() const { return m_sequence; }
+
+private:
+    friend class Analyzer;
+    friend class AnalysisFrameSlot;
+
+    AnalysisFrame() = default;
+    const AnalysisFrame &source() const { return m_analysis ? *m_analysis : *this; }
+
+    QVector<Tone> m_harmonics;
+    Spectrum m_spectrum;
+    Spectrum m_autocorrelation;
+    QVector<Tone> m_snacPeaks;
+    SharedAnalysisFrame m_analysis; // The full analysis of an update
+    quint64 m_sequence = 0;
+};
+
+/* Latest analysis frame, published by one writer to any number of readers in
+ * any thread.
+ *
+ * The slot recycles a fixed pool of frames. The writer fills the oldest frame
+ * that neither the readers nor other frames refer to and publishes it as the
+ * latest. Readers share the latest frame for as long as they like. The writer,
+ * the latest frame and the full analysis it may update take three frames, and
+ * the rest leave room for readers that hold on to older ones. Should readers
+ * hold on to all of them, the writer skips a frame rather than allocate. The
+ * frames keep their buffers, so a steady stream of frames allocates nothing.
+ */
+class AnalysisFrameSlot
+{
+public:
+    AnalysisFrameSlot();
+
+    // The latest frame, null before the first is published
+    SharedAnalysisFrame latest() const;
+    // A frame to fill and pass to publish(). Its contents are those of an
+    // older frame. Null if no frame is free.
+    AnalysisFrame *beginWrite();
+    void publish(AnalysisFrame *frame);
+
+private:
+    mutable QMutex m_mutex;
+    QVector<QExplicitlySharedDataPointer<AnalysisFrame>> m_frames;
+    int m_latest;   // Index of the latest frame, -1 before the first
+    quint64 m_published;
+};
+
+#endif // ANALYSISFRAME_H
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "audiofilereader.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+
+namespace {
+    // Size of the mapped window of the file
+    const qint64 MapWindow = 32 * 1024 * 1024;
+
+    const quint16 WavePcm = 1;
+    const quint16 WaveExtensible = 0xFFFE;
+
+    template<typename T> inline T read(const uchar *data)
+    {
+        return qFromLittleEndian<T>(data);
+    }
+}
+
+AudioFileReader::AudioFileReader(const QString &fileName)
+    : m_file(fileName)
+    , m_dataOffset(0)
+    , m_dataSize(0)
+    , m_direct(false)
+    , m_map(nullptr)
+    , m_mapOffset(0)
+    , m_mapSize(0)
+{
+}
+
+AudioFileReader::~AudioFileReader()
+{
+    if (m_map)
+        m_file.unmap(m_map);
+}
+
+bool AudioFileReader::open()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_error = m_file.errorString();
+        return false;
+    }
+    return readWavHeader();
+}
+
+bool AudioFileReader::openRaw(const QAudioFormat &format)
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_error = m_file.errorString();
+        return false;
+    }
+    m_dataOffset = 0;
+    m_dataSize = m_file.size();
+    return setFormat(format);
+}
+
+QString AudioFileReader::errorString() const
+{
+    return m_error;
+}
+
+QAudioFormat AudioFileReader::format() const
+{
+    return m_format;
+}
+
+qint64 AudioFileReader::frameCount() const
+{
+    return m_format.bytesPerFrame() > 0 ? m_dataSize / m_format.bytesPerFrame() : 0;
+}
+
+AudioView AudioFileReader::view(qint64 frame, qint64 count, int channel)
+{
+    AudioView view;
+    view.format = m_outputFormat;
+    count = std::max<qint64>(0, std::min(count, frameCount() - frame));
+    const int frameBytes = m_format.bytesPerFrame();
+    const uchar *data = map(m_dataOffset + frame * frameBytes, count * frameBytes);
+    if (!data || count == 0)
+        return view;
+
+    if (m_direct) {
+        view.data[0] = reinterpret_cast<const char*>(data);
+        view.size[0] = count * frameBytes;
+        return view;
+    }
+
+    // Extract the channel, widening 24 bit samples to 32 bits
+    const int sampleBytes = m_format.sampleSize() / 8;
+    const int outputBytes = m_outputFormat.sampleSize() / 8;
+    m_scratch.resize(count * outputBytes);
+    char *out = m_scratch.data();
+    data += channel * sampleBytes;
+    for (qint64 i = 0; i < count; ++i, data += frameBytes, out += outputBytes) {
+        switch (sampleBytes) {
+        case 1:
+            *out = *data;
+            break;
+        case 2:
+            *reinterpret_cast<qint16*>(out) = read<qint16>(data);
+            break;
+        case 3:
+            *reinterpret_cast<qint32*>(out) = qint32(quint32(data[0]) << 8 | quint32(data[1]) << 16 | quint32(data[2]) << 24);
+            break;
+        case 4:
+            *reinterpret_cast<qint32*>(out) = read<qint32>(data);
+            break;
+        }
+    }
+    view.data[0] = m_scratch.constData();
+    view.size[0] = m_scratch.size();
+    return view;
+}
+
+bool AudioFileReader::readWavHeader()
+{
+    const QByteArray riff = m_file.read(12);
+    if (riff.size() < 12 || !riff.startsWith("RIFF") || riff.mid(8, 4) != "WAVE") {
+        m_error = QStringLiteral("Not a RIFF/WAVE file");
+        return false;
+    }
+
+    QAudioFormat format;
+    bool haveFormat = false;
+    while (!m_file.atEnd()) {
+        const QByteArray header = m_file.read(8);
+        if (header.size() < 8)
+            break;
+        const auto id = header.left(4);
+        const qint64 size = read<quint32>(reinterpret_cast<const uchar*>(header.constData() + 4));
+        if (id == "fmt ") {
+            const QByteArray fmt = m_file.read(size);
+            if (fmt.size() < 16)
+                break;
+            const auto data = reinterpret_cast<const uchar*>(fmt.constData());
+            auto type = read<quint16>(data);
+            // The extensible format stores the actual type in its sub-format
+            if (type == WaveExtensible && fmt.size() >= 26)
+                type = read<quint16>(data + 24);
+            if (type != WavePcm) {
+                m_error = QStringLiteral("Only integer PCM data is supported");
+                return false;
+            }
+            const int sampleSize = read<quint16>(data + 14);
+            format.setCodec(QStringLiteral("audio/pcm"));
+            format.setChannelCount(read<quint16>(data + 2));
+            format.setSampleRate(read<quint32>(data + 4));
+            format.setSampleSize(sampleSize);
+            format.setSampleType(sampleSize == 8 ? QAudioFormat::UnSignedInt : QAudioFormat::SignedInt);
+            format.setByteOrder(QAudioFormat::LittleEndian);
+            haveFormat = true;
+            m_file.seek(m_file.pos() + (size % 2));
+        } else if (id == "data") {
+            if (!haveFormat)
+                break;
+            m_dataOffset = m_file.pos();
+            m_dataSize = std::min(size, m_file.size() - m_dataOffset);
+            return setFormat(format);
+        } else {
+            // Chunks are padded to an even size
+            m_file.seek(m_file.pos() + size + (size % 2));
+        }
+    }
+    m_error = QStringLiteral("No audio data found");
+    return false;
+}
+
+bool AudioFileReader::setFormat(const QAudioFormat &format)
+{
+    const int sampleSize = format.sampleSize();
+    if (format.channelCount() < 1 || (sampleSize != 8 && sampleSize != 16 && sampleSize != 24 && sampleSize != 32)) {
+        m_error = QStringLiteral("Unsupported sample format");
+        return false;
+    }
+    m_format = format;
+    m_outputFormat = format;
+    m_outputFormat.setChannelCount(1);
+    m_outputFormat.setByteOrder(QAudioFormat::Endian(QSysInfo::ByteOrder));
+    if (sampleSize == 24) {
+        m_outputFormat.setSampleSize(32);
+        m_outputFormat.setSampleType(QAudioFormat::SignedInt);
+    }
+    m_direct = format.channelCount() == 1 && sampleSize != 24
+        && (sampleSize == 8 || format.byteOrder() == m_outputFormat.byteOrder());
+    return true;
+}
+
+const uchar *AudioFileReader::map(qint64 offset, qint64 size)
+{
+    if (!m_map || offset < m_mapOffset || offset + size > m_mapOffset + m_mapSize) {
+        if (m_map)
+            m_file.unmap(m_map);
+        m_mapOffset = offset;
+        m_mapSize = std::min(std::max(size, MapWindow), m_file.size() - offset);
+        m_map = m_file.map(m_mapOffset, m_mapSize);
+        if (!m_map) {
+            m_error = m_file.errorString();
+            return nullptr;
+        }
+    }
+    return m_map + (offset - m_mapOffset);
+}
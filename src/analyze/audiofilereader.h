@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIOFILEREADER_H
+#define AUDIOFILEREADER_H
+
+#include "ringbuffer.h"
+
+#include <QtGlobal>
+#include <QAudioFormat>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+/* Memory-mapped reader for WAV and raw PCM files.
+ *
+ * Only a window of the file is mapped at any time, so memory use does not
+ * depend on the length of the recording. Mono files in native byte order are
+ * read in place; for other files the requested channel is converted into a
+ * scratch buffer of one segment.
+ */
+class AudioFileReader
+{
+public:
+    explicit AudioFileReader(const QString &fileName);
+    ~AudioFileReader();
+
+    // Open a WAV file, taking the format from its header
+    bool open();
+    // Open a headerless file of samples in the given format
+    bool openRaw(const QAudioFormat &format);
+    QString errorString() const;
+
+    // Format of the file, which may contain several channels
+    QAudioFormat format() const;
+    // Number of samples per channel
+    qint64 frameCount() const;
+    // View of count samples of one channel, starting at the given frame. The
+    // view remains valid until the next call.
+    AudioView view(qint64 frame, qint64 count, int channel = 0);
+
+private:
+    bool readWavHeader();
+    bool setFormat(const QAudioFormat &format);
+    const uchar *map(qint64 offset, qint64 size);
+
+    QFile m_file;
+    QString m_error;
+    QAudioFormat m_format;
+    QAudioFormat m_outputFormat;
+    qint64 m_dataOffset;
+    qint64 m_dataSize;
+    bool m_direct;  // Whether samples can be used without conversion
+    uchar *m_map;
+    qint64 m_mapOffset;
+    qint64 m_mapSize;
+    QByteArray m_scratch;
+};
+
+#endif // AUDIOFILEREADER_H
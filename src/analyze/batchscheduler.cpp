@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batchscheduler.h"
+
+#include <QMutexLocker>
+
+#include <thread>
+
+BatchScheduler::BatchScheduler(int workerCount)
+    : m_workerCount(qMax(1, workerCount))
+    , m_queues(m_workerCount)
+    , m_next(0)
+    , m_pending(0)
+{
+}
+
+int BatchScheduler::workerCount() const
+{
+    return m_workerCount;
+}
+
+void BatchScheduler::run(int taskCount, const Task &task, const Sink &sink)
+{
+    m_results.assign(taskCount, QByteArray());
+    m_finished.assign(taskCount, false);
+    m_next = 0;
+    m_pending.store(taskCount);
+
+    // Deal the tasks out in turn, so every worker starts with low numbers
+    for (int i = 0; i < taskCount; ++i)
+        m_queues[i % m_workerCount].tasks.push_back(i);
+
+    std::vector<std::thread> threads;
+    threads.reserve(m_workerCount);
+    for (int w = 0; w < m_workerCount; ++w)
+        threads.emplace_back(&BatchScheduler::work, this, w, std::cref(task));
+
+    for (int i = 0; i < taskCount; ++i) {
+        QByteArray output;
+        {
+            QMutexLocker lock(&m_mutex);
+            while (!m_finished[i])
+                m_changed.wait(&m_mutex);
+            output.swap(m_results[i]);
+            m_next = i + 1;
+            m_changed.wakeAll();
+        }
+        sink(i, output);
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+void BatchScheduler::work(int worker, const Task &task)
+{
+    const int window = 4 * m_workerCount;
+    while (m_pending.load() > 0) {
+        m_mutex.lock();
+        const int next = m_next;
+        m_mutex.unlock();
+
+        const int t = takeTask(worker, next + window);
+        if (t < 0) {
+            // All remaining tasks are too far ahead of the output
+            QMutexLocker lock(&m_mutex);
+            while (m_next == next && m_pending.load() > 0)
+                m_changed.wait(&m_mutex);
+            continue;
+        }
+
+        QByteArray output = task(worker, t);
+        QMutexLocker lock(&m_mutex);
+        m_results[t].swap(output);
+        m_finished[t] = true;
+        m_changed.wakeAll();
+    }
+}
+
+// Take the first task below limit from the worker's own queue or, failing
+// that, from another worker's queue. Tasks are taken from the front in both
+// cases, because the output can only proceed once the lowest task is done.
+int BatchScheduler::takeTask(int worker, int limit)
+{
+    for (int i = 0; i < m_workerCount; ++i) {
+        auto &queue = m_queues[(worker + i) % m_workerCount];
+        QMutexLocker lock(&queue.mutex);
+        if (!queue.tasks.empty() && queue.tasks.front() < limit) {
+            const int task = queue.tasks.front();
+            queue.tasks.pop_front();
+            m_pending.deref();
+            return task;
+        }
+    }
+    return -1;
+}
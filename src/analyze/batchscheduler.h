@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCHSCHEDULER_H
+#define BATCHSCHEDULER_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+/* Runs a batch of independent tasks on a fixed number of worker threads.
+ *
+ * Tasks are dealt out to per-worker queues; a worker that runs out of tasks
+ * steals from the others. Each task produces a block of output, which is
+ * handed back to the calling thread in task order, so the combined output
+ * does not depend on the number of workers or on timing. Workers do not run
+ * ahead of the output by more than a few tasks per worker, which bounds the
+ * memory held by finished but unwritten results.
+ */
+class BatchScheduler
+{
+public:
+    // Run a task on the given worker, returning its output
+    using Task = std::function<QByteArray(int worker, int task)>;
+    // Receive the output of a task
+    using Sink = std::function<void(int task, const QByteArray &output)>;
+
+    explicit BatchScheduler(int workerCount);
+
+    int workerCount() const;
+    // Run tasks 0 to taskCount - 1, calling sink from this thread in order
+    void run(int taskCount, const Task &task, const Sink &sink);
+
+private:
+    struct WorkerQueue
+    {
+        QMutex mutex;
+        std::deque<int> tasks;
+    };
+
+    void work(int worker, const Task &task);
+    int takeTask(int worker, int limit);
+
+    const int m_workerCount;
+    std::vector<WorkerQueue> m_queues;
+    QMutex m_mutex;
+    QWaitCondition m_changed;
+    std::vector<QByteArray> m_results;
+    std::vector<bool> m_finished;
+    int m_next;     // Next task to hand to the sink
+    QAtomicInt m_pending;   // Tasks not yet started
+};
+
+#endif // BATCHSCHEDULER_H
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Command line tool that runs the tuner's analysis on recorded audio files and
+// prints one line per analysed segment.
+
+#include "analyzer.h"
+#include "audiofilereader.h"
+#include "batchscheduler.h"
+#include "fftengine.h"
+#include "pitchtable.h"
+#include "version.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#include <math.h>
+#include <memory>
+
+namespace {
+    // Long files are split into chunks of this many hops, which are analysed
+    // in parallel. The split does not depend on the number of threads, so the
+    // output does not either.
+    const qint64 ChunkHops = 256;
+    // Seconds replayed ahead of a chunk by the modes that remember more than
+    // the averaged spectra, but at least this many hops. This is long enough
+    // for the noise estimate to fill its window of a few seconds, for the
+    // exponential average to settle and, since the replayed segments form one
+    // continuous stream, for the decimator, the time domain filter and the
+    // hum canceller to settle.
+    const qreal SettlingTime = 6;
+    const qint64 SettlingHops = 128;
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    struct Options
+    {
+        Analyzer::Settings settings;
+        qreal overlap = 0.5;
+        qreal a4 = 440;
+        int channel = 0;
+        bool json = false;
+        bool raw = false;
+        QAudioFormat rawFormat;
+    };
+
+    struct Chunk
+    {
+        QString file;
+        QString label;  // File name as printed, if any
+        int sampleRate;
+        qint64 firstHop;
+        qint64 endHop;
+    };
+
+    void writeHeader(const Options &options, bool withFile)
+    {
+        if (!options.json)
+            out << (withFile ? "file," : "") << "time,frequency,note,deviation,clarity\n";
+    }
+
+    void writeResult(QTextStream &stream, const Options &options, const QString &file, qreal time, qreal frequency, const Note &note, qreal deviation, qreal clarity)
+    {
+        const auto noteName = frequency > 0 ? note.name + note.octave : QString();
+        if (options.json) {
+            stream << '{';
+            if (!file.isEmpty())
+                stream << "\"file\":\"" << QString(file).replace('\\', "\\\\").replace('"', "\\\"") << "\",";
+            stream << "\"time\":" << QString::number(time, 'f', 4)
+                   << ",\"frequency\":" << QString::number(frequency, 'f', 3)
+                   << ",\"note\":\"" << noteName
+                   << "\",\"deviation\":" << QString::number(deviation, 'f', 2)
+                   << ",\"clarity\":" << QString::number(clarity, 'f', 4) << "}\n";
+        } else {
+            if (!file.isEmpty())
+                stream << file << ',';
+            stream << QString::number(time, 'f', 4) << ','
+                   << QString::number(frequency, 'f', 3) << ','
+                   << noteName << ','
+                   << QString::number(deviation, 'f', 2) << ','
+                   << QString::number(clarity, 'f', 4) << '\n';
+        }
+    }
+
+    bool openReader(AudioFileReader &reader, const Options &options)
+    {
+        return options.raw ? reader.openRaw(options.rawFormat) : reader.open();
+    }
+
+    qint64 hopSize(const Options &options)
+    {
+        return std::max<qint64>(1, options.settings.segmentLength * (1 - options.overlap));
+    }
+
+    // Hops to replay ahead of a chunk. The moving average only depends on the
+    // last numSpectra segments, so replaying those reproduces an
+    // uninterrupted run exactly. The other stateful modes, including the
+    // filters of the audio stream, have a longer memory, which the replay
+    // only approximately restores.
+    qint64 warmUpHops(const Options &options, int sampleRate)
+    {
+        const auto &settings = options.settings;
+        const bool longMemory = settings.enableNoiseFilter || settings.averaging == Analyzer::ExponentialAverage
+            || settings.maxFrequency > 0 || settings.timeDomainFilter || settings.cancelHum;
+        if (!longMemory)
+            return settings.numSpectra - 1;
+        return std::max<qint64>(SettlingHops, qint64(ceil(SettlingTime * sampleRate / hopSize(options))));
+    }
+
+    // Divide the hops of all files into chunks
+    QVector<Chunk> planChunks(const QStringList &files, const Options &options, bool withFile, bool &ok)
+    {
+        QVector<Chunk> chunks;
+        const qint64 length = options.settings.segmentLength;
+        const qint64 hop = hopSize(options);
+        for (const auto &file : files) {
+            AudioFileReader reader(file);
+            if (!openReader(reader, options)) {
+                err << file << ": " << reader.errorString() << endl;
+                ok = false;
+                continue;
+            }
+            const auto format = reader.format();
+            if (options.channel >= format.channelCount()) {
+                err << file << ": no channel " << options.channel << endl;
+                ok = false;
+                continue;
+            }
+            const qint64 frames = reader.frameCount();
+            const qint64 hops = frames < length ? 0 : (frames - length) / hop + 1;
+            for (qint64 first = 0; first < hops; first += ChunkHops)
+                chunks.append({file, withFile ? file : QString(), format.sampleRate(), first, std::min(first + ChunkHops, hops)});
+        }
+        return chunks;
+    }
+
+    QByteArray analyzeChunk(Analyzer &analyzer, const Chunk &chunk, const Options &options)
+    {
+        QByteArray output;
+        AudioFileReader reader(chunk.file);
+        if (!openReader(reader, options)) {
+            qWarning() << chunk.file << reader.errorString();
+            return output;
+        }
+        if (analyzer.settings().sampleRate != chunk.sampleRate) {
+            auto settings = analyzer.settings();
+            settings.sampleRate = chunk.sampleRate;
+            analyzer.setSettings(settings);
+        }
+        analyzer.reset();
+
+        QTextStream stream(&output);
+        const PitchTable pitchTable(options.a4);
+        const qint64 length = options.settings.segmentLength;
+        const qint64 hop = hopSize(options);
+        qreal time = 0;
+        bool report = false;
+
+        const auto connection = QObject::connect(&analyzer, &Analyzer::done, [&] {
+            if (!report)
+                return;
+            const auto frame = analyzer.latestFrame();
+            const auto &harmonics = frame->harmonics();
+            const auto &snacPeaks = frame->snacPeaks();
+            qreal frequency = 0;
+            qreal deviation = 0;
+            Note note;
+            if (!harmonics.isEmpty()) {
+                frequency = harmonics.first().frequency;
+                note = pitchTable.closestNote(frequency);
+                deviation = 1200 * std::log2(frequency / note.frequency);
+            }
+            const qreal clarity = snacPeaks.isEmpty() ? 0 : snacPeaks.first().amplitude;
+            writeResult(stream, options, chunk.label, time, frequency, note, deviation, clarity);
+        });
+
+        // Replay the hops preceding the chunk that its first results depend
+        // on, see warmUpHops(). Each result is reported at the end of its
+        // segment, which is when it would have become available in real time.
+        // The segments after the first continue its stream.
+        const qint64 warmUp = std::min(chunk.firstHop, warmUpHops(options, chunk.sampleRate));
+        const qint64 firstHop = chunk.firstHop - warmUp;
+        for (qint64 h = firstHop; h < chunk.endHop; ++h) {
+            report = h >= chunk.firstHop;
+            time = qreal(h * hop + length) / chunk.sampleRate;
+            analyzer.doAnalysis(reader.view(h * hop, length, options.channel), h == firstHop ? -1 : hop);
+        }
+        QObject::disconnect(connection);
+        stream.flush();
+        return output;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("ktuner-analyze"));
+    QCoreApplication::setApplicationVersion(QStringLiteral(PROJECT_VERSION));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Run KTuner's pitch analysis on recorded audio files."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("WAV or raw PCM files to analyse."), QStringLiteral("files..."));
+    const QCommandLineOption formatOption(QStringLiteral("output"), QStringLiteral("Output format, csv or json (one object per line)."), QStringLiteral("format"), QStringLiteral("csv"));
+    const QCommandLineOption lengthOption(QStringLiteral("segment-length"), QStringLiteral("Number of samples per analysed segment."), QStringLiteral("samples"), QStringLiteral("4096"));
+    const QCommandLineOption overlapOption(QStringLiteral("overlap"), QStringLiteral("Overlap of consecutive segments, from 0 to 0.9."), QStringLiteral("fraction"), QStringLiteral("0.5"));
+    const QCommandLineOption windowOption(QStringLiteral("window"), QStringLiteral("Window function: rectangular, hann or gaussian."), QStringLiteral("name"), QStringLiteral("rectangular"));
+    const QCommandLineOption precisionOption(QStringLiteral("precision"), QStringLiteral("Floating point precision of the transforms: double or single."), QStringLiteral("name"), QStringLiteral("double"));
+    const QCommandLineOption spectraOption(QStringLiteral("num-spectra"), QStringLiteral("Number of spectra to average."), QStringLiteral("count"), QStringLiteral("5"));
+    const QCommandLineOption averagingOption(QStringLiteral("averaging"), QStringLiteral("Averaging of spectra: moving or exponential."), QStringLiteral("name"), QStringLiteral("moving"));
+    const QCommandLineOption maxFrequencyOption(QStringLiteral("max-frequency"), QStringLiteral("Reduce the sample rate to keep frequencies up to this one, 0 to analyse the full band."), QStringLiteral("Hz"), QStringLiteral("0"));
+    const QCommandLineOption timeFilterOption(QStringLiteral("time-domain-filter"), QStringLiteral("Band limit the audio stream instead of each spectrum."));
+    const QCommandLineOption humOption(QStringLiteral("cancel-hum"), QStringLiteral("Remove 50 or 60 Hz mains hum from the audio stream."));
+    const QCommandLineOption a4Option(QStringLiteral("a4"), QStringLiteral("Pitch of A4 in Hz."), QStringLiteral("frequency"), QStringLiteral("440"));
+    const QCommandLineOption channelOption(QStringLiteral("channel"), QStringLiteral("Channel to analyse in multichannel files."), QStringLiteral("index"), QStringLiteral("0"));
+    const QCommandLineOption rawOption(QStringLiteral("raw"), QStringLiteral("Read headerless little endian PCM files."));
+    const QCommandLineOption rateOption(QStringLiteral("rate"), QStringLiteral("Sample rate of raw files."), QStringLiteral("Hz"), QStringLiteral("44100"));
+    const QCommandLineOption bitsOption(QStringLiteral("bits"), QStringLiteral("Bits per sample of raw files (8, 16, 24 or 32)."), QStringLiteral("bits"), QStringLiteral("16"));
+    const QCommandLineOption channelsOption(QStringLiteral("channels"), QStringLiteral("Number of channels of raw files."), QStringLiteral("count"), QStringLiteral("1"));
+    const QCommandLineOption jobsOption(QStringLiteral("jobs"), QStringLiteral("Number of analysis threads."), QStringLiteral("count"), QString::number(QThread::idealThreadCount()));
+    parser.addOptions({formatOption, lengthOption, overlapOption, windowOption, precisionOption, spectraOption, averagingOption, maxFrequencyOption, timeFilterOption, humOption,
+                       a4Option, channelOption, rawOption, rateOption, bitsOption, channelsOption, jobsOption});
+    parser.process(app);
+    // Plan synchronously, so that all workers use identical transforms and the
+    // output does not depend on timing
+    FftPlanner::setBackgroundPlanning(false);
+
+    const auto files = parser.positionalArguments();
+    if (files.isEmpty())
+        parser.showHelp(1);
+
+    Options options;
+    options.json = parser.value(formatOption) == QLatin1String("json");
+    options.settings.segmentLength = parser.value(lengthOption).toUInt();
+    options.settings.numSpectra = std::max(1u, parser.value(spectraOption).toUInt());
+    options.settings.maxFrequency = std::max(0.0, parser.value(maxFrequencyOption).toDouble());
+    options.settings.timeDomainFilter = parser.isSet(timeFilterOption);
+    options.settings.cancelHum = parser.isSet(humOption);
+    options.overlap = qBound(0.0, parser.value(overlapOption).toDouble(), 0.9);
+    options.settings.segmentOverlap = options.overlap;
+    options.a4 = parser.value(a4Option).toDouble();
+    options.channel = parser.value(channelOption).toInt();
+    const auto window = parser.value(windowOption);
+    if (window == QLatin1String("hann"))
+        options.settings.windowFunction = Analyzer::Hann;
+    else if (window == QLatin1String("gaussian"))
+        options.settings.windowFunction = Analyzer::Gaussian;
+    if (parser.value(precisionOption) == QLatin1String("single"))
+        options.settings.precision = Analyzer::SinglePrecision;
+    if (parser.value(averagingOption) == QLatin1String("exponential"))
+        options.settings.averaging = Analyzer::ExponentialAverage;
+    if (options.settings.segmentLength < 4) {
+        err << "Invalid segment length" << endl;
+        return 1;
+    }
+
+    options.raw = parser.isSet(rawOption);
+    if (options.raw) {
+        const int bits = parser.value(bitsOption).toInt();
+        options.rawFormat.setCodec(QStringLiteral("audio/pcm"));
+        options.rawFormat.setSampleRate(parser.value(rateOption).toInt());
+        options.rawFormat.setSampleSize(bits);
+        options.rawFormat.setChannelCount(parser.value(channelsOption).toInt());
+        options.rawFormat.setSampleType(bits == 8 ? QAudioFormat::UnSignedInt : QAudioFormat::SignedInt);
+        options.rawFormat.setByteOrder(QAudioFormat::LittleEndian);
+    }
+
+    const bool withFile = files.size() > 1;
+    bool ok = true;
+    const auto chunks = planChunks(files, options, withFile, ok);
+
+    // Every worker owns an analyzer, and with it its FFTW plans and buffers.
+    // They are created up front, as planning cannot run in parallel anyway.
+    BatchScheduler scheduler(std::max(1, parser.value(jobsOption).toInt()));
+    std::vector<std::unique_ptr<Analyzer>> analyzers;
+    for (int i = 0; i < scheduler.workerCount(); ++i)
+        analyzers.emplace_back(new Analyzer(options.settings));
+
+    writeHeader(options, withFile);
+    scheduler.run(chunks.size(), [&](int worker, int task) {
+        return analyzeChunk(*analyzers[worker], chunks.at(task), options);
+    }, [&](int, const QByteArray &output) {
+        out << output;
+        out.flush();
+    });
+    return ok ? 0 : 1;
+}
@@ -18,129 +18,487 @@
  */
 
 #include "analyzer.h"
-#include "ktunerconfig.h"
+#include "framequeue.h"
 
-#include <QAudioBuffer>
 #include <QDebug>
 
 #include <math.h>
+#include <algorithm>
+#include <array>
 #include <functional>
 
-#include <fftw3.h>
+namespace {
+    // Number of recently used transforms kept per precision
+    const int TransformCacheSize = 4;
+    // Number of frames after which the running sum of the moving average is
+    // recomputed from the history
+    const quint32 RenormalizationInterval = 1000;
+    // Fast updates follow the fundamental within this many bins of where the
+    // last full analysis found it. Two more bins on either side are needed to
+    // apply the window.
+    const int TrackedBins = 8;
+    const int WindowBins = 2;
+    // Number of harmonics, including the fundamental, refined on a fine grid
+    const int RefinedHarmonics = 3;
+    // Number of the highest spectral peaks above the fundamental that are
+    // checked for harmonics
+    const int HarmonicPeaks = 32;
+    // Band of interest, limited by a Butterworth filter of this order
+    const qreal FilterLow = 75;
+    const qreal FilterHigh = 15000;
+    const quint16 FilterOrder = 4;
+    // Shortest segment length of the adaptive mode, in analysed samples
+    const quint32 MinimumSegmentLength = 512;
+    // The adaptive mode only shortens the segment if it would still span this
+    // much more than the required number of periods, in this many consecutive
+    // analyses. Lengthening is immediate, because a segment that is too short
+    // loses the fundamental.
+    const qreal ShorteningMargin = 1.2;
+    const int ShorteningVotes = 3;
+}
 
 Analyzer::Analyzer(QObject *parent)
+    : Analyzer(Settings(), parent)
+{
+}
+
+Analyzer::Analyzer(const Settings &settings, QObject *parent)
     : QObject(parent)
     , m_state(Loading)
+    , m_settings(settings)
+    , m_queue(nullptr)
+    , m_noiseFilter(false)
+    , m_sampleSize(0)
+    , m_decimation(1)
     , m_binFreq(0)
-    , m_numNoiseSegments(10)
-    , m_filterPass(0)
-    , m_plan(nullptr)
-    , m_ifftPlan(nullptr)
+    , m_cacheCapacity(TransformCacheSize)
+    , m_averaging(MovingAverage)
+    , m_numSpectra(0)
     , m_currentSpectrum(0)
+    , m_numAveraged(0)
+    , m_sinceRenormalization(0)
+    , m_updateCount(0)
+    , m_firstTrackedBin(0)
+    , m_frameEnd(0)
+    , m_shortenVotes(0)
+    , m_streaming(false)
+    , m_streamRunning(false)
 {
+    // The results and the buffers of the fast updates are reused by every
+    // frame, so that a steady-state frame allocates nothing
+    m_harmonics.reserve(HarmonicPeaks + 1);
+    m_snacPeaks.reserve(1);
+    m_trackedFrequencies.resize(2 * (TrackedBins + WindowBins) + 1);
+    m_trackedSpectrum.resize(2 * TrackedBins + 1);
     init();
-    connect(KTunerConfig::self(), &KTunerConfig::configChanged, this, &Analyzer::init);
-    connect(KTunerConfig::self(), &KTunerConfig::noiseFilterChanged, this, &Analyzer::setNoiseFilter);
 }
 
 void Analyzer::init()
 {
     setState(Loading);
-    if (m_sampleSize != (quint32)KTunerConfig::segmentLength()) {
-        m_sampleSize = KTunerConfig::segmentLength();
-        m_outputSize = m_sampleSize + 1;
-        m_window.resize(m_sampleSize);
-        m_input.resize(2 * m_sampleSize);
-        m_output.resize(m_outputSize);
-        m_spectrum.resize(m_outputSize);
-        m_noiseSpectrum.resize(m_outputSize);
-
-        // FFTW and C++(99) complex types are binary compatible
-        auto output = reinterpret_cast<fftw_complex*>(m_output.data());
-        m_plan = fftw_plan_dft_r2c_1d(m_input.size(), m_input.data(), output, FFTW_MEASURE);
-        m_ifftPlan = fftw_plan_dft_c2r_1d(m_input.size(), output, m_input.data(), FFTW_ESTIMATE);
+    const bool single = m_settings.precision == SinglePrecision;
+    const bool precisionChanged = single == m_single.isNull();
+    if (single) {
+        m_double.reset();
+        m_doubleCache.clear();
+    } else {
+        m_single.reset();
+        m_singleCache.clear();
     }
-    if (m_numSpectra != (quint32)KTunerConfig::numSpectra()) {
-        m_numSpectra = KTunerConfig::numSpectra();
-        m_currentSpectrum %= m_numSpectra;
-        m_spectrumHistory.fill(m_spectrum, m_numSpectra);
+
+    // The decimation factor must divide the segment length
+    const quint32 oldLength = segmentLength();
+    quint32 decimation = Decimator::factorFor(m_settings.sampleRate, m_settings.maxFrequency);
+    while (m_settings.segmentLength % decimation != 0)
+        decimation /= 2;
+    const bool decimationChanged = decimation != m_decimation;
+    m_decimation = decimation;
+    if (decimationChanged)
+        m_decimator.setFactor(m_decimation);
+    else
+        m_decimator.reset();
+    m_streamInput.resize(m_decimation > 1 ? m_settings.segmentLength : 0);
+    m_streaming = m_decimation > 1 || m_settings.timeDomainFilter || m_settings.cancelHum;
+    m_stream.fill(0, m_streaming ? m_settings.segmentLength / m_decimation : 0);
+    m_streamRunning = false;
+    m_humCanceller.setSampleRate(qreal(m_settings.sampleRate) / m_decimation);
+    // The time domain filter runs after decimation, at the analysed rate. It
+    // replaces the filter of the spectrum, which must follow when it is
+    // switched.
+    const bool filterSwitched = m_settings.timeDomainFilter != (m_inputFilter.size() > 0);
+    m_inputFilter = BiquadCascade();
+    if (m_settings.timeDomainFilter) {
+        const qreal rate = qreal(m_settings.sampleRate) / m_decimation;
+        m_inputFilter = ButterworthFilter(FilterLow, FilterHigh, FilterOrder, rate).digitalFilter();
     }
-    m_binFreq = qreal(KTunerConfig::sampleRate()) / m_input.size();
-    calculateWindow();
-    setNoiseFilter(KTunerConfig::enableNoiseFilter());
-    setFftFilter();
+
+    // The adaptive mode halves the configured length down to the minimum.
+    // Transforms and windows of all these lengths are prepared here, so that
+    // switching between them never waits for the planner.
+    m_segmentLengths = {m_settings.segmentLength};
+    while (m_settings.adaptiveLength && m_segmentLengths.last() % (2 * m_decimation) == 0
+           && m_segmentLengths.last() / (2 * m_decimation) >= MinimumSegmentLength)
+        m_segmentLengths << m_segmentLengths.last() / 2;
+    m_cacheCapacity = std::max(TransformCacheSize, m_segmentLengths.size());
+    for (const auto length : m_segmentLengths) {
+        // The input is zero padded to twice its length to obtain the ACF
+        const int size = 2 * length / m_decimation;
+        if (single)
+            calculateWindow(*cachedTransform(m_singleCache, size, m_cacheCapacity));
+        else
+            calculateWindow(*cachedTransform(m_doubleCache, size, m_cacheCapacity));
+    }
+
+    // Keep the current length if it is still one of the choices
+    quint32 length = m_settings.segmentLength;
+    if (m_settings.adaptiveLength && m_segmentLengths.contains(oldLength))
+        length = oldLength;
+    // Spectra of another length or sample rate cannot be averaged with new
+    // ones, and neither average can continue the other
+    const qreal binFreq = qreal(m_settings.sampleRate) / (2 * length);
+    const bool resetSpectra = m_numSpectra != m_settings.numSpectra || m_averaging != m_settings.averaging;
+    m_numSpectra = m_settings.numSpectra;
+    m_averaging = m_settings.averaging;
+    if (length != oldLength || decimationChanged || precisionChanged || binFreq != m_binFreq)
+        setSegmentLength(length);
+    else if (filterSwitched)
+        setFftFilter();
+    if (resetSpectra || filterSwitched)
+        resetAverage();
+    // Keep the noise estimate, which setSegmentLength() resampled if the bins
+    // changed, unless the noise filter was switched
+    setNoiseInterval();
+    if (m_noiseFilter != m_settings.enableNoiseFilter)
+        setNoiseFilter(m_settings.enableNoiseFilter);
+    m_firstTrackedBin = 0;
+    m_frameEnd = 0;
+    m_shortenVotes = 0;
     setState(Ready);
 }
 
+void Analyzer::setSegmentLength(quint32 length)
+{
+    m_sampleSize = length / m_decimation;
+    m_outputSize = m_sampleSize + 1;
+    m_rawSpectrum.resize(m_outputSize);
+    m_updateInput.resize(m_sampleSize);
+    m_spectrum.resize(m_outputSize);
+    if (m_settings.precision == SinglePrecision)
+        m_single = cachedTransform(m_singleCache, 2 * m_sampleSize, m_cacheCapacity);
+    else
+        m_double = cachedTransform(m_doubleCache, 2 * m_sampleSize, m_cacheCapacity);
+
+    m_binFreq = qreal(m_settings.sampleRate) / (2 * length);
+    m_rawSpectrum.setBinSpacing(m_binFreq);
+    m_spectrum.setBinSpacing(m_binFreq);
+    setNoiseInterval();
+    resampleNoiseSpectrum();
+    resetAverage();
+    setFftFilter();
+    m_firstTrackedBin = 0;
+    emit segmentLengthChanged(length);
+}
+
+void Analyzer::adaptSegmentLength()
+{
+    // Shortest prepared length of at least the given number of samples
+    const auto lengthFor = [this](qreal samples) {
+        auto length = m_segmentLengths.first();
+        for (const auto l : m_segmentLengths) {
+            if (l >= samples)
+                length = l;
+        }
+        return length;
+    };
+    // Without a fundamental, return to the longest length, which is able to
+    // find the lowest notes
+    const qreal f0 = m_harmonics.isEmpty() ? 0 : m_harmonics.first().frequency;
+    quint32 required = m_segmentLengths.first();
+    quint32 shorter = required;
+    if (f0 > 0) {
+        const qreal samples = m_settings.periodsPerSegment * m_currentFormat.sampleRate() / f0;
+        required = lengthFor(samples);
+        shorter = lengthFor(ShorteningMargin * samples);
+    }
+    if (required > segmentLength()) {
+        m_shortenVotes = 0;
+        setSegmentLength(required);
+    } else if (shorter < segmentLength()) {
+        if (++m_shortenVotes >= ShorteningVotes) {
+            m_shortenVotes = 0;
+            setSegmentLength(shorter);
+        }
+    } else {
+        m_shortenVotes = 0;
+    }
+}
+
+void Analyzer::resampleNoiseSpectrum()
+{
+    // Interpolate the noise estimate at the new bin frequencies and let the
+    // estimator continue from there. The amplitudes of broadband noise grow
+    // with the square root of the segment length.
+    const Spectrum noise = m_noiseSpectrum;
+    m_noiseSpectrum = Spectrum(m_outputSize, m_binFreq);
+    if (noise.size() < 2 || m_noiseEstimator.isEmpty()) {
+        m_noiseEstimator.reset(m_outputSize);
+        return;
+    }
+    const qreal step = m_binFreq / noise.binSpacing();
+    const qreal scale = std::sqrt(1 / step);
+    for (quint32 i = 0; i < m_outputSize; ++i) {
+        const qreal x = i * step;
+        const int k = int(x);
+        if (k + 1 >= noise.size())
+            break;
+        m_noiseSpectrum[i] = scale * (noise[k] + (x - k) * (noise[k + 1] - noise[k]));
+    }
+    m_noiseEstimator.reset(m_noiseSpectrum.constAmplitudes(), m_outputSize);
+}
+
+void Analyzer::setNoiseInterval()
+{
+    // The estimator sees one spectrum per hop of the current length
+    const qreal overlap = qBound(0.0, m_settings.segmentOverlap, 0.99);
+    m_noiseEstimator.setFrameInterval(segmentLength() * (1 - overlap) / m_settings.sampleRate);
+}
+
+AudioView Analyzer::currentSegment(const AudioView &input) const
+{
+    return input.last(qint64(segmentLength()) * (input.format.sampleSize() / 8));
+}
+
+void Analyzer::readSegment(const AudioView &segment, qint64 newSamples)
+{
+    if (m_streaming)
+        readStream(segment, newSamples);
+    preProcess(segment);
+    if (m_settings.fastUpdates)
+        readUpdateInput(segment, m_sampleSize);
+}
+
+void Analyzer::readUpdateSegment(const AudioView &segment, qint64 newSamples)
+{
+    if (m_streaming)
+        newSamples = readStream(segment, newSamples);
+    else if (newSamples < 0)
+        newSamples = segmentLength();
+    readUpdateInput(segment, newSamples);
+}
+
+int Analyzer::readStream(const AudioView &segment, qint64 newSamples)
+{
+    // Start over after a gap, dropping the first few samples so that the last
+    // output coincides with the last input sample. A segment of only new
+    // samples that directly follows the previous one continues the stream.
+    const int available = std::min<qint64>(segmentLength(), segment.sampleCount());
+    const bool restart = !m_streamRunning || newSamples < 0 || newSamples > available;
+    int count = restart ? available : std::max<qint64>(0, newSamples);
+    m_streamRunning = true;
+    if (restart) {
+        m_decimator.reset();
+        m_stream.fill(0);
+        count -= count % m_decimation;
+    }
+
+    // Shift the stream to make room for the new samples. As the decimation
+    // factor divides the configured length, a segment never produces more
+    // than fit.
+    qreal *s = m_stream.data();
+    const int size = m_stream.size();
+    int produced = count;
+    if (m_decimation > 1) {
+        count = convertTail(segment, count, m_streamInput.data());
+        produced = m_decimator.outputCount(count);
+        Q_ASSERT(produced <= size);
+        std::copy(s + produced, s + size, s);
+        produced = m_decimator.process(m_streamInput.constData(), count, s + size - produced);
+    } else {
+        std::copy(s + produced, s + size, s);
+        convertTail(segment, count, s + size - produced);
+    }
+
+    // Cancel the hum and filter the new samples, continuing from the state
+    // left by the previous ones. A new stream lets the canceller adapt to its
+    // samples first, and starts the filter from the steady state of its first
+    // sample.
+    qreal *newest = s + size - produced;
+    if (m_settings.cancelHum) {
+        if (restart)
+            m_humCanceller.prime(newest, produced);
+        m_humCanceller.process(newest, produced);
+    }
+    if (restart && produced > 0)
+        m_inputFilter.reset(newest[0]);
+    m_inputFilter.process(newest, produced);
+    return produced;
+}
+
 Analyzer::~Analyzer()
 {
-    fftw_destroy_plan(m_plan);
-    fftw_destroy_plan(m_ifftPlan);
-    fftw_cleanup();
 }
 
-void Analyzer::doAnalysis(const QAudioBuffer &input)
+template<typename T>
+QSharedPointer<Analyzer::Transform<T>> Analyzer::cachedTransform(TransformCache<T> &cache, int size, int capacity)
+{
+    QSharedPointer<Transform<T>> transform;
+    const auto cached = std::find_if(cache.begin(), cache.end(), [=](const QSharedPointer<Transform<T>> &t) {
+        return t->fft.size() == size;
+    });
+    if (cached != cache.end()) {
+        transform = *cached;
+        cache.erase(cached);
+    } else {
+        transform.reset(new Transform<T>(size));
+        while (cache.size() >= capacity)
+            cache.removeLast();
+    }
+    cache.prepend(transform);
+    return transform;
+}
+
+void Analyzer::doAnalysis(const AudioView &input, qint64 newSamples)
 {
     if (m_state != Ready)
         return;
-    if (m_calibrateFilter)
-        setState(CalibratingFilter);
-    else
-        setState(Processing);
+    const auto segment = currentSegment(input);
+    if (newSamples < 0 || newSamples > segment.sampleCount())
+        newSamples = -1;
+    readSegment(segment, newSamples);
+    analyzeInput();
+}
 
-    // Process the bytearray into m_input and store a copy for computation of
-    // the SNAC function
-    m_currentFormat = input.format();
-    preProcess(input);
-    auto processedInput = m_input;
-    processedInput.detach();
+void Analyzer::updateAnalysis(const AudioView &input, int newSamples)
+{
+    if (m_state != Ready)
+        return;
+    readUpdateSegment(currentSegment(input), newSamples);
+    analyzeUpdate();
+}
+
+void Analyzer::analyzeInput()
+{
+    if (m_single)
+        analyzeInput(*m_single);
+    else
+        analyzeInput(*m_double);
+    // The input of the full analysis is in m_updateInput
+    if (m_settings.fastUpdates)
+        startTracking();
+    if (m_settings.adaptiveLength)
+        adaptSegmentLength();
+}
 
-    getSpectrum();
-    if (m_calibrateFilter)
-        calibrateFilter();
+template<typename T>
+void Analyzer::analyzeInput(Transform<T> &transform)
+{
+    // Store a copy of the preprocessed input for computation of the SNAC
+    // function
+    const T *input = transform.fft.input();
+    std::copy(input, input + m_sampleSize, transform.signal.begin());
+
+    getSpectrum(transform);
+    // The noise estimate follows every spectrum, so that the noise filter
+    // needs no calibration and adapts to changing noise
+    if (m_noiseFilter)
+        m_noiseEstimator.update(m_rawSpectrum.constAmplitudes(), m_noiseSpectrum.amplitudes());
     processSpectrum();
 
     // Finally, compute the normalised ACF and frequency estimate
-    getAcf();
-    const auto snac = computeSnac(m_input, processedInput);
-    const auto snacPeak = determineSnacFundamental(snac);
-    Spectrum snacPeaks;
+    getAcf(transform);
+    computeSnac(input, transform.signal.constData(), m_snac);
+    const auto snacPeak = determineSnacFundamental(m_snac);
+    m_snacPeaks.clear();
     if (snacPeak.frequency > 0)
-        snacPeaks << snacPeak;
+        m_snacPeaks << snacPeak;
 
     // The accuracy of the obtained fundamental is fair, but can be improved
     // using the accurate power spectrum stored earlier, which also allows
     // identifying overtones
-    const auto harmonics = findHarmonics(m_spectrum, m_currentFormat.sampleRate() / snacPeak.frequency);
+    findHarmonics(m_spectrum, m_currentFormat.sampleRate() / (m_decimation * snacPeak.frequency), m_harmonics);
+    if (m_settings.refinePeaks)
+        refineHarmonics(m_harmonics, transform.signal.constData());
 
     // Report analysis results
-    setState(Ready);
-    emit done(harmonics, m_spectrum, snac, snacPeaks);
+    publishAnalysis();
+}
+
+void Analyzer::setFrameQueue(FrameQueue *queue)
+{
+    m_queue = queue;
+}
+
+void Analyzer::processQueue()
+{
+    // Wait for each frame in the queue rather than be notified of it, which
+    // would post an event per frame. The wait is interrupted to let the event
+    // loop handle configuration changes between frames.
+    if (!m_queue)
+        return;
+    for (AudioFrame frame; m_queue->waitPop(frame); frame = AudioFrame()) {
+        if (m_state == Loading) {
+            m_queue->reportDropped();
+            continue;
+        }
+        setState(Processing);
+        const auto view = currentSegment(frame.view());
+        const quint64 frameEnd = frame.position + frame.size;
+        // Samples the sliding DFT and the stream have not seen yet; after a
+        // gap, when frames were dropped or the previous one was not intact,
+        // they start over from the whole segment
+        const int bytesPerSample = view.format.sampleSize() / 8;
+        qint64 newSamples = -1;
+        if (m_frameEnd > 0 && frameEnd > m_frameEnd && bytesPerSample > 0)
+            newSamples = (frameEnd - m_frameEnd) / bytesPerSample;
+        if (newSamples < 0 || newSamples > segmentLength())
+            newSamples = -1;
+        if (frame.update)
+            readUpdateSegment(view, newSamples);
+        else
+            readSegment(view, newSamples);
+        // The audio input may have wrapped around onto the frame while it was
+        // being read, in which case the input is garbage. The next frame then
+        // starts over.
+        if (!frame.isIntact()) {
+            m_firstTrackedBin = 0;
+            m_queue->reportDropped();
+        } else if (frame.update) {
+            analyzeUpdate();
+        } else {
+            analyzeInput();
+        }
+        m_frameEnd = frame.isIntact() ? frameEnd : 0;
+    }
+    if (m_state == Processing)
+        setState(Ready);
 }
 
-void Analyzer::getSpectrum()
+template<typename T>
+void Analyzer::getSpectrum(Transform<T> &transform)
 {
-    fftw_execute(m_plan);
+    transform.fft.forward();
     // Extract the spectrum from the output. The zeroth output element is the
     // gain, which can be disregarded.
-    auto o = m_output.constBegin() + 1;
-    auto f = m_filter.constBegin() + 1;
-    auto s = m_spectrum.begin() + 1;
-    for (int i = 1; i < m_output.size(); ++i, ++o, ++s, ++f) {
-        s->frequency = i * m_binFreq;
-        s->amplitude = std::abs(*f * *o);
-    }
+    const auto o = transform.fft.output();
+    const auto f = m_filter.constData();
+    float *s = m_rawSpectrum.amplitudes();
+    s[0] = 0;
+    for (quint32 i = 1; i < m_outputSize; ++i)
+        s[i] = float(std::abs(f[i] * ButterworthFilter::creal(o[i])));
 }
 
-void Analyzer::getAcf()
+template<typename T>
+void Analyzer::getAcf(Transform<T> &transform)
 {
     // Prepare the output vector and compute the autocorrelation function,
-    // which replaces m_input
-    m_output[0] = 0;
-    auto s = m_spectrum.constBegin() + 1;
-    for (auto o = m_output.begin() + 1, oEnd = m_output.end(); o < oEnd; ++o, ++s)
-        *o = std::pow(s->amplitude, 2);
-    fftw_execute(m_ifftPlan);
+    // which replaces the input
+    auto o = transform.fft.output();
+    const auto oEnd = o + m_outputSize;
+    *o = 0;
+    auto s = m_spectrum.constAmplitudes() + 1;
+    for (++o; o < oEnd; ++o, ++s)
+        *o = T(*s * *s);
+    transform.fft.inverse();
 }
 
 void Analyzer::setState(Analyzer::State newState)
@@ -156,176 +514,258 @@ Analyzer::State Analyzer::state() const
     return m_state;
 }
 
+Analyzer::Settings Analyzer::settings() const
+{
+    return m_settings;
+}
+
+quint32 Analyzer::segmentLength() const
+{
+    return m_sampleSize * m_decimation;
+}
+
+quint32 Analyzer::decimation() const
+{
+    return m_decimation;
+}
+
+void Analyzer::setSettings(const Analyzer::Settings &settings)
+{
+    m_settings = settings;
+    init();
+}
+
 void Analyzer::setNoiseFilter(bool enable)
 {
-    m_calibrateFilter = enable;
-    if (!enable) {
-        m_filterPass = 0;
-        m_noiseSpectrum.fill(0);
-    }
+    m_noiseFilter = enable;
+    m_noiseSpectrum.fill(0);
+    m_noiseEstimator.reset(m_outputSize);
 }
 
 void Analyzer::setFftFilter()
 {
-    m_filter.clear();
-    m_filter.reserve(m_outputSize);
-    auto filter = ButterworthFilter(75, 15000, 4, m_binFreq * m_input.size());
-    for (int i = 0; i < m_output.size(); ++i)
-        m_filter << filter(i * m_binFreq);
+    // The time domain filter has band limited the input already
+    if (m_settings.timeDomainFilter) {
+        m_filter.fill(ButterworthFilter::creal(1), m_outputSize);
+        return;
+    }
+    const qreal rate = m_settings.sampleRate;
+    const auto cached = std::find_if(m_filterCache.begin(), m_filterCache.end(), [&](const FilterResponse &r) {
+        return r.sampleRate == rate && r.binSpacing == m_binFreq && r.response.size() == int(m_outputSize);
+    });
+    if (cached != m_filterCache.end()) {
+        const FilterResponse entry = *cached;
+        m_filterCache.erase(cached);
+        m_filterCache.prepend(entry);
+    } else {
+        FilterResponse entry {rate, m_binFreq, ButterworthFilter::CVector(m_outputSize)};
+        ButterworthFilter(FilterLow, FilterHigh, FilterOrder, rate).response(m_binFreq, m_outputSize, entry.response.data());
+        while (m_filterCache.size() >= m_cacheCapacity)
+            m_filterCache.removeLast();
+        m_filterCache.prepend(entry);
+    }
+    // The response is shared with the cache
+    m_filter = m_filterCache.first().response;
+}
+
+void Analyzer::reset()
+{
+    m_streamRunning = false;
+    resetAverage();
+    setNoiseFilter(m_settings.enableNoiseFilter);
 }
 
 void Analyzer::resetFilter()
 {
-    m_calibrateFilter = true;
-    m_filterPass = 0;
+    m_noiseEstimator.reset(m_outputSize);
 }
 
-void Analyzer::calculateWindow()
+template<typename T>
+void Analyzer::calculateWindow(Transform<T> &transform)
 {
+    const quint32 n = transform.window.size();
     std::function<qreal(int)> wFunction = [](int){ return 1; };
-    switch(KTunerConfig::windowFunction()) {
+    switch(m_settings.windowFunction) {
     default:
         break;
     case WindowFunction::Hann:
-        wFunction = [&](int i){ return 0.5 * (1 - std::cos((2 * M_PI * i) / (m_sampleSize - 1))); };
+        wFunction = [&](int i){ return 0.5 * (1 - std::cos((2 * M_PI * i) / (n - 1))); };
         break;
     case WindowFunction::Gaussian:
         wFunction = [&](int i){
-            return std::exp(-0.5 * std::pow((i - 0.5 * (m_sampleSize - 1)) / (0.25 * 0.5 * (m_sampleSize - 1)), 2));
+            return std::exp(-0.5 * std::pow((i - 0.5 * (n - 1)) / (0.25 * 0.5 * (n - 1)), 2));
         };
         break;
     }
-    for (quint32 i = 0; i < m_sampleSize; ++i)
-        m_window[i] = wFunction(i);
+    for (quint32 i = 0; i < n; ++i)
+        transform.window[i] = T(wFunction(i));
 }
 
-void Analyzer::preProcess(const QAudioBuffer &input)
+void Analyzer::preProcess(const AudioView &input)
 {
-    m_input.fill(0);
-    switch (input.format().sampleSize()) {
-    case 8:
-        extractAndScale<qint8>(input);
-        break;
-    case 16:
-        extractAndScale<qint16>(input);
-        break;
-    case 32:
-        extractAndScale<qint32>(input);
-        break;
-    case 64:
-        extractAndScale<qint64>(input);
-        break;
-    }
+    if (m_single)
+        preProcess(*m_single, input);
+    else
+        preProcess(*m_double, input);
+}
 
-    // Find a simple least squares fit y = ax + b to the scaled input
-    const auto xMean = 0.5 * (m_sampleSize + 1);
-    const auto sum = std::accumulate(m_input.constBegin(), m_input.constBegin() + m_sampleSize, 0);
-    const auto yMean = sum / m_sampleSize;
-    qreal covXY = 0;    // Cross-covariance
-    qreal varX = 0;     // Variance
-
-    auto y = m_input.constBegin();
-    for (int x = 0; x < m_input.size(); ++x, ++y) {
-        const auto dx = x - xMean;
-        covXY += dx * (*y - yMean);
-        varX += dx * dx;
+template<typename T>
+void Analyzer::preProcess(Transform<T> &transform, const AudioView &input)
+{
+    m_currentFormat = input.format;
+    T *data = transform.fft.input();
+    Preprocess::Sums sums;
+    int count = 0;
+    if (m_streaming) {
+        // The stream is already scaled
+        count = m_sampleSize;
+        Preprocess::convert(m_stream.constData() + m_stream.size() - count, count, 0, T(1), data, sums);
+    } else {
+        switch (input.format.sampleSize()) {
+        case 8:
+            // The offset of unsigned samples is removed by the linear fit below
+            if (input.format.sampleType() == QAudioFormat::UnSignedInt)
+                count = extractAndScale<quint8>(input, data, sums);
+            else
+                count = extractAndScale<qint8>(input, data, sums);
+            break;
+        case 16:
+            count = extractAndScale<qint16>(input, data, sums);
+            break;
+        case 32:
+            count = extractAndScale<qint32>(input, data, sums);
+            break;
+        case 64:
+            count = extractAndScale<qint64>(input, data, sums);
+            break;
+        }
+    }
+    // Missing samples and the padding are zero
+    std::fill(data + count, data + transform.fft.size(), T(0));
+
+    // Find a simple least squares fit y = ax + b to the N = m_sampleSize
+    // scaled input samples, where x = 0 ... N - 1. The time domain filter
+    // has removed the offset and drift already.
+    qreal a = 0;
+    qreal b = 0;
+    if (!m_settings.timeDomainFilter) {
+        const qreal n = m_sampleSize;
+        const qreal xMean = 0.5 * (n - 1);
+        const qreal yMean = sums.y / n;
+        const qreal varX = n * (n * n - 1) / 12;     // Sum of (x - xMean)^2
+        const qreal covXY = sums.xy - xMean * sums.y; // Sum of (x - xMean)(y - yMean)
+        a = varX > 0 ? covXY / varX : 0;
+        b = yMean - a * xMean;
     }
-    const auto a = covXY / varX;
-    const auto b = yMean - a * xMean;
 
-    // Subtract this fit and apply the window function
-    auto i = m_input.begin();
-    auto w = m_window.constBegin();
-    for (int x = 0; x < m_input.size(); ++i, ++w, ++x)
-        *i = *w * (*i - (a * x + b));
+    // Subtract this fit and apply the window function, leaving the zero
+    // padding intact
+    Preprocess::detrendAndWindow(data, transform.window.constData(), m_sampleSize, T(a), T(b));
 }
 
-template<typename T>
-void Analyzer::extractAndScale(const QAudioBuffer &input)
-{
-    const T *data = input.constData<T>();
-    const qreal scale = std::pow(2, 8*sizeof(T) - 1);
-    const uint end = std::min(m_sampleSize, (uint)input.sampleCount());
-    const auto iBegin = m_input.begin();
-    for (auto i = iBegin; i < iBegin + end; ++i, ++data)
-        *i = *data / scale;
-}
-
-void Analyzer::calibrateFilter()
-{
-    if (m_filterPass == 0) {
-        ++m_filterPass;
-        m_noiseSpectrum = m_spectrum;
-        for (auto &t : m_noiseSpectrum)
-            t.amplitude /= m_numNoiseSegments;
-    } else if (m_filterPass < m_numNoiseSegments) {
-        ++m_filterPass;
-        auto s = m_spectrum.constBegin();
-        for (auto &t : m_noiseSpectrum)
-            t.amplitude += s++->amplitude / m_numNoiseSegments;
-    } else {
-        m_filterPass = 0;
-        m_calibrateFilter = false;
+template<typename S, typename T>
+int Analyzer::extractAndScale(const AudioView &input, T *output, Preprocess::Sums &sums)
+{
+    const T scale = std::pow(2, 8*sizeof(S) - 1);
+    int converted = 0;
+    auto remaining = std::min(m_sampleSize, (uint)input.sampleCount());
+    // The samples may wrap around the end of the ring buffer
+    for (int part = 0; part < 2 && remaining > 0; ++part) {
+        const S *data = reinterpret_cast<const S*>(input.data[part]);
+        const auto count = std::min<qint64>(remaining, input.size[part] / sizeof(S));
+        Preprocess::convert(data, count, converted, scale, output + converted, sums);
+        converted += count;
+        remaining -= count;
     }
+    return converted;
 }
 
 void Analyzer::processSpectrum()
 {
-    m_spectrumHistory[m_currentSpectrum].swap(m_spectrum);
-    m_currentSpectrum = (m_currentSpectrum + 1) % m_numSpectra;
+    const float *x = m_rawSpectrum.constAmplitudes();
+    qreal *sum = m_average.data();
+    qreal scale = 1;
+    if (m_averaging == ExponentialAverage) {
+        // Start from the first spectrum rather than from zero
+        const qreal alpha = m_numAveraged == 0 ? 1 : 2.0 / (m_numSpectra + 1);
+        for (quint32 i = 0; i < m_outputSize; ++i)
+            sum[i] += alpha * (x[i] - sum[i]);
+        m_numAveraged = 1;
+    } else {
+        // Replace the oldest spectrum, both in the history and in the sum
+        float *oldest = m_spectrumHistory[m_currentSpectrum].amplitudes();
+        for (quint32 i = 0; i < m_outputSize; ++i) {
+            sum[i] += qreal(x[i]) - oldest[i];
+            oldest[i] = x[i];
+        }
+        m_currentSpectrum = (m_currentSpectrum + 1) % m_numSpectra;
+        m_numAveraged = std::min(m_numAveraged + 1, m_numSpectra);
+        if (++m_sinceRenormalization == RenormalizationInterval)
+            renormalizeAverage();
+        scale = 1.0 / m_numAveraged;
+    }
 
-    static QVector<qreal> average;
-    average.fill(0, m_outputSize);
+    const qreal *n = m_noiseSpectrum.constAmplitudes();
+    qreal *s = m_spectrum.amplitudes();
+    for (quint32 i = 0; i < m_outputSize; ++i)
+        s[i] = std::max(0.0, sum[i] * scale - n[i]);
+}
 
-    for (const auto &h : m_spectrumHistory) {
-        auto hPoint = h.constBegin();
-        for (auto &a : average)
-            a +=  hPoint++->amplitude;
-    }
+void Analyzer::resetAverage()
+{
+    m_currentSpectrum = 0;
+    m_numAveraged = 0;
+    m_sinceRenormalization = 0;
+    m_average.fill(0, m_outputSize);
+    const int historySize = m_averaging == MovingAverage ? m_numSpectra : 0;
+    m_spectrumHistory.fill(CompactSpectrum(m_outputSize, m_binFreq), historySize);
+}
 
-    auto n = m_noiseSpectrum.constBegin();
-    auto a = average.constBegin();
-    for (auto &s : m_spectrum) {
-        s.amplitude = std::max(0.0,  *a / m_numSpectra - n->amplitude);
-        ++n; ++a;
+void Analyzer::renormalizeAverage()
+{
+    m_sinceRenormalization = 0;
+    qreal *sum = m_average.data();
+    std::fill(sum, sum + m_outputSize, 0.0);
+    for (const auto &h : m_spectrumHistory) {
+        const float *a = h.constAmplitudes();
+        for (quint32 i = 0; i < m_outputSize; ++i)
+            sum[i] += a[i];
     }
 }
 
-Spectrum Analyzer::computeSnac(const QVector<double> acf, const QVector<double> signal) const
+template<typename T>
+void Analyzer::computeSnac(const T *acf, const T *signal, Spectrum &snac) const
 {
-    Spectrum snac(m_sampleSize);
+    // The bins of the SNAC are lags, in samples
+    snac.resize(m_sampleSize);
+    snac.setBinSpacing(1);
+    qreal *s = snac.amplitudes();
     const quint32 W = m_sampleSize;
     qreal mSum = 2 * acf[0];
-    int tau = 0;
-    for (auto &s : snac) {
-        s = Tone(tau, 2 * acf[tau] / mSum);
-        ++tau;
-        const auto m1 = signal[tau - 1];
-        const auto m2 = signal[W - tau];
+    for (quint32 tau = 0; tau < W; ++tau) {
+        s[tau] = 2 * acf[tau] / mSum;
+        const auto m1 = signal[tau];
+        const auto m2 = signal[W - tau - 1];
         mSum -= m1 * m1 + m2 * m2;
     }
-    return snac;
 }
 
-Tone Analyzer::determineSnacFundamental(const Spectrum snac) const
+Tone Analyzer::determineSnacFundamental(const Spectrum &snac) const
 {
     Tone result;
-    const auto peaks = snac.findPeaks();
-    if (peaks.isEmpty())
+    int zero;
+    if (snac.findZeros(&zero, 1) == 0)
         return result;
 
-    // First find the highest peak other than the first SNAC value, which
-    // should be 1.0, then pick the first peak after the first zero crossing
-    // that exceeds 0.8 times that value
-    const auto maxPeak = *std::max_element(peaks.constBegin(), peaks.constEnd(), [](const Tone *t1, const Tone *t2) {
-        return *t1 < *t2;
-    });
-    const auto zeros = snac.findZeros(1);
-    auto pick = std::find_if(peaks.begin(), peaks.end(), [&](const Tone *t) {
-        return t > zeros.first() && t->amplitude > 0.8 * maxPeak->amplitude;
-    });
-    if (pick != peaks.end()) {
-        result = quadraticInterpolation(*pick);
+    // Only the peaks after the first zero crossing can mark a period. First
+    // find the highest of them, then pick the first that exceeds 0.8 times
+    // its value, which ends the second search early.
+    const int first = zero + 1;
+    int peak;
+    if (snac.findHighestPeaks(&peak, 1, 0, first) == 0)
+        return result;
+    if (snac.findPeaks(&peak, 1, 0.8 * snac[peak], first) == 1) {
+        result = snac.quadraticInterpolation(peak);
         Q_ASSERT(result.frequency > 0);
     }
     return result;
@@ -333,26 +773,212 @@ Tone Analyzer::determineSnacFundamental(const Spectrum snac) const
 
 // Algorithm: first interpolate the spectral peak corresponding to fApprox,
 // then locate the (near-)integer multiples of its frequency
-Spectrum Analyzer::findHarmonics(const Spectrum spectrum, qreal fApprox) const
+void Analyzer::findHarmonics(const Spectrum &spectrum, qreal fApprox, QVector<Tone> &harmonics) const
 {
-    Spectrum harmonics;
+    harmonics.clear();
     if (fApprox <= 0 || std::isinf(fApprox))
-        return harmonics;
-    const auto peaks = spectrum.findPeaks(0.01);
-    if (peaks.isEmpty())
-        return harmonics;
-
-    harmonics.reserve(peaks.size());
-    const auto iFund = std::floor(fApprox / m_binFreq) + 1;
-    const auto fundamental = quadraticInterpolation(&spectrum[iFund]);
+        return;
+    // Interpolation needs a neighbour on either side
+    const int iFund = std::floor((fApprox - spectrum.offset()) / spectrum.binSpacing()) + 1;
+    if (iFund < 1 || iFund >= spectrum.size() - 1)
+        return;
+    // Only the highest peaks from the fundamental up are candidates
+    std::array<int, HarmonicPeaks> peaks;
+    const int count = spectrum.findHighestPeaks(peaks.data(), HarmonicPeaks, 0.01, iFund - 1);
+    if (count == 0)
+        return;
+
+    const auto fundamental = spectrum.quadraticInterpolation(iFund);
     harmonics.append(fundamental);
-    for (const auto peak : peaks) {
-        if (peak->frequency > fundamental.frequency) {
-            const Tone t = quadraticInterpolation(peak);
+    for (int i = 0; i < count; ++i) {
+        const int peak = peaks[i];
+        if (spectrum.frequency(peak) > fundamental.frequency) {
+            const Tone t = spectrum.quadraticInterpolation(peak);
             const qreal ratio = t.frequency / fundamental.frequency;
             if (qAbs(1200 * std::log2(ratio / qRound(ratio))) < 10)
                 harmonics.append(t);
         }
     }
-    return harmonics;
 }
+
+// The interpolated peaks are biased towards the nearest bin. Zooming in on
+// them with the windowed input removes most of the bias.
+template<typename T>
+void Analyzer::refineHarmonics(QVector<Tone> &harmonics, const T *signal) const
+{
+    // Radians per sample per Hz; the bins are pi / N apart
+    const qreal scale = M_PI / (m_sampleSize * m_binFreq);
+    const qreal span = 2 * M_PI / m_sampleSize;
+    const int count = std::min(harmonics.size(), RefinedHarmonics);
+    for (int i = 0; i < count; ++i) {
+        auto &t = harmonics[i];
+        t.frequency = Goertzel::refinePeak(signal, m_sampleSize, t.frequency * scale, span) / scale;
+    }
+}
+
+void Analyzer::readUpdateInput(const AudioView &input, int count)
+{
+    if (m_streaming) {
+        // The sliding DFT follows the stream
+        count = qBound(0, count, int(m_sampleSize));
+        std::copy(m_stream.constEnd() - count, m_stream.constEnd(), m_updateInput.begin());
+        m_updateCount = count;
+        return;
+    }
+    m_updateCount = convertTail(input, count, m_updateInput.data());
+}
+
+int Analyzer::convertTail(const AudioView &input, int count, qreal *output)
+{
+    count = qBound(0, count, std::min<int>(segmentLength(), input.sampleCount()));
+    switch (input.format.sampleSize()) {
+    case 8:
+        if (input.format.sampleType() == QAudioFormat::UnSignedInt) {
+            // Remove the offset, which would leak into the tracked bins
+            extractTail<quint8>(input, count, output);
+            for (int i = 0; i < count; ++i)
+                output[i] -= 1;
+        } else {
+            extractTail<qint8>(input, count, output);
+        }
+        break;
+    case 16:
+        extractTail<qint16>(input, count, output);
+        break;
+    case 32:
+        extractTail<qint32>(input, count, output);
+        break;
+    case 64:
+        extractTail<qint64>(input, count, output);
+        break;
+    default:
+        count = 0;
+    }
+    return count;
+}
+
+template<typename S>
+void Analyzer::extractTail(const AudioView &input, int count, qreal *output)
+{
+    const qreal scale = std::pow(2, 8*sizeof(S) - 1);
+    Preprocess::Sums sums;
+    qint64 skip = std::min<qint64>(segmentLength(), input.sampleCount()) - count;
+    int converted = 0;
+    for (int part = 0; part < 2 && converted < count; ++part) {
+        const S *data = reinterpret_cast<const S*>(input.data[part]);
+        const qint64 available = input.size[part] / sizeof(S);
+        if (skip >= available) {
+            skip -= available;
+            continue;
+        }
+        const int n = std::min<qint64>(count - converted, available - skip);
+        Preprocess::convert(data + skip, n, converted, scale, output + converted, sums);
+        converted += n;
+        skip = 0;
+    }
+}
+
+void Analyzer::startTracking()
+{
+    m_firstTrackedBin = 0;
+    if (m_harmonics.isEmpty() || m_updateCount < int(m_sampleSize))
+        return;
+    const int centre = qRound(m_harmonics.first().frequency / m_binFreq);
+    const int first = centre - TrackedBins - WindowBins;
+    const int last = centre + TrackedBins + WindowBins;
+    if (first < 1 || last >= int(m_outputSize))
+        return;
+
+    // The bins of the zero padded transform are spaced pi / N apart
+    Q_ASSERT(m_trackedFrequencies.size() == last - first + 1);
+    for (int k = first; k <= last; ++k)
+        m_trackedFrequencies[k - first] = M_PI * k / m_sampleSize;
+    m_tracker.setup(m_sampleSize, m_trackedFrequencies);
+    m_tracker.reset(m_updateInput.constData());
+    m_firstTrackedBin = first;
+}
+
+void Analyzer::analyzeUpdate()
+{
+    if (m_firstTrackedBin == 0 || m_updateCount == 0)
+        return;
+    m_tracker.push(m_updateInput.constData(), m_updateCount);
+
+    // The sliding DFT sees the unwindowed input. The Hann window can be
+    // applied to it as a convolution of neighbouring bins, X(k) / 2 -
+    // (X(k - 2) + X(k + 2)) / 4 on this grid; the Gaussian window has no
+    // such form and is approximated by it.
+    const bool windowed = m_settings.windowFunction != Rectangular;
+    Spectrum &tracked = m_trackedSpectrum;
+    tracked.setBinSpacing(m_binFreq, (m_firstTrackedBin + WindowBins) * m_binFreq);
+    for (int i = 0; i < tracked.size(); ++i) {
+        const int j = i + WindowBins;
+        auto y = m_tracker.value(j);
+        if (windowed)
+            y = 0.5 * y - 0.25 * (m_tracker.value(j - 2) + m_tracker.value(j + 2));
+        const int bin = m_firstTrackedBin + j;
+        tracked[i] = std::max(0.0, std::abs(m_filter.at(bin) * y) - m_noiseSpectrum[bin]);
+    }
+
+    // Stop tracking once the peak leaves the tracked bins; the next full
+    // analysis finds it again
+    const auto a = tracked.constAmplitudes();
+    const int peak = std::max_element(a, a + tracked.size()) - a;
+    if (peak == 0 || peak == tracked.size() - 1 || a[peak] <= 0) {
+        m_firstTrackedBin = 0;
+        return;
+    }
+    publishUpdate(tracked.quadraticInterpolation(peak));
+}
+
+void Analyzer::publishAnalysis()
+{
+    // Copy the results element by element into the recycled frame, as
+    // sharing them would make the next analysis allocate. Readers that hold
+    // on to every frame miss this one.
+    AnalysisFrame *frame = m_frames.beginWrite();
+    if (!frame)
+        return;
+    frame->m_harmonics.reserve(HarmonicPeaks + 1);
+    frame->m_harmonics.resize(m_harmonics.size());
+    std::copy(m_harmonics.constBegin(), m_harmonics.constEnd(), frame->m_harmonics.begin());
+    frame->m_spectrum.copyFrom(m_spectrum);
+    frame->m_autocorrelation.copyFrom(m_snac);
+    frame->m_snacPeaks.resize(m_snacPeaks.size());
+    std::copy(m_snacPeaks.constBegin(), m_snacPeaks.constEnd(), frame->m_snacPeaks.begin());
+    m_frames.publish(frame);
+    m_lastAnalysis = SharedAnalysisFrame(frame);
+    emit done();
+}
+
+void Analyzer::publishUpdate(const Tone &fundamental)
+{
+    // The update refers to the last full analysis for its spectra
+    AnalysisFrame *frame = m_frames.beginWrite();
+    if (!frame)
+        return;
+    frame->m_harmonics.reserve(HarmonicPeaks + 1);
+    frame->m_harmonics.resize(m_harmonics.size());
+    std::copy(m_harmonics.constBegin(), m_harmonics.constEnd(), frame->m_harmonics.begin());
+    frame->m_harmonics[0] = fundamental;
+    frame->m_analysis = m_lastAnalysis;
+    m_frames.publish(frame);
+    emit done();
+}
+
+SharedAnalysisFrame Analyzer::latestFrame() const
+{
+    return m_frames.latest();
+}
+
+// The individual stages are also used by the benchmark
+template void Analyzer::preProcess(Transform<double> &, const AudioView &);
+template void Analyzer::preProcess(Transform<float> &, const AudioView &);
+template void Analyzer::getSpectrum(Transform<double> &);
+template void Analyzer::getSpectrum(Transform<float> &);
+template void Analyzer::getAcf(Transform<double> &);
+template void Analyzer::getAcf(Transform<float> &);
+template void Analyzer::computeSnac(const double *, const double *, Spectrum &) const;
+template void Analyzer::computeSnac(const float *, const float *, Spectrum &) const;
+template void Analyzer::refineHarmonics(QVector<Tone> &, const double *) const;
+template void Analyzer::refineHarmonics(QVector<Tone> &, const float *) const;
@@ -22,103 +22,320 @@
 
 #include "tone.h"
 #include "spectrum.h"
+#include "analysisframe.h"
+#include "biquadcascade.h"
 #include "butterworthfilter.h"
+#include "decimator.h"
+#include "fftengine.h"
+#include "goertzel.h"
+#include "humcanceller.h"
+#include "noiseestimator.h"
+#include "preprocess.h"
+#include "ringbuffer.h"
+#include "slidingdft.h"
 
 #include <QtGlobal>
 #include <QObject>
 #include <QAudioFormat>
+#include <QSharedPointer>
 #include <QVector>
 
 // Include std complex first to allow complex arithmetic
 #include <complex.h>
 
-class QAudioBuffer;
+class FrameQueue;
 class QAudioInput;
 class QIODevice;
-class fftw_plan_s;
 
 /* The Analyzer class determines the fundamental frequency in a series of audio
  * samples.
  * 
  * Analysis starts by preprocessing the raw audio input to scale it by the
  * maximum sample value, remove a linear least squares fit and apply a windowing
- * function. The resulting input array is transformed by FFTW's DFT algorithm
- * and its output used to calculate the power spectrum. This is followed by
- * calculation of the Harmonic Product Spectrum in order to find the fundamental 
- * frequency bin. Finally, the exact peak frequency is estimated by 
- * interpolation.
+ * function, using the vectorised kernels of preprocess.h. The resulting input
+ * array is transformed by FFTW's DFT algorithm and its output used to calculate
+ * the power spectrum. This is followed by calculation of the Harmonic Product
+ * Spectrum in order to find the fundamental frequency bin. Finally, the exact
+ * peak frequency is estimated by interpolation and refined by evaluating the
+ * spectrum of the current segment on a fine grid around the fundamental and its
+ * first harmonics.
+ *
+ * With the noise filter enabled, a running estimate of the background noise
+ * is subtracted from the averaged spectrum. The estimate follows the minimum
+ * of each bin over the last few seconds of spectra, so it adapts to changing
+ * noise without a calibration phase.
+ *
+ * Between full analyses, fast updates can follow the fundamental at a much
+ * higher rate. A sliding DFT of the raw input tracks only the bins around the
+ * last fundamental, which costs a few complex multiply-adds per bin and new
+ * sample.
+ *
+ * When the device samples much faster than the highest frequency of interest,
+ * the input can be decimated first. A streaming FIR lowpass filter
+ * reduces the sample rate by a power of two chosen from that frequency, and
+ * the transforms of a segment shrink by the same factor; the segment lengths
+ * in the settings and signals still count input samples.
+ *
+ * The band limiting filter is normally applied to the spectrum of each
+ * segment. Alternatively, its digital counterpart filters the input stream
+ * sample by sample, with its state carried over between segments. It removes
+ * the offset and slow drift of the input before the window is applied, so
+ * the preprocessing then skips the least squares fit.
+ *
+ * Mains hum can be removed from the stream as well, before that filter. An
+ * adaptive canceller subtracts its fit of the mains frequency and harmonics
+ * sample by sample, detecting 50 or 60 Hz mains and following their drift.
+ *
+ * In the adaptive length mode, the configured segment length is a maximum.
+ * After each analysis the Analyzer picks the shortest of the prepared lengths
+ * that still spans the configured number of periods of the fundamental, so
+ * that high notes are analysed more often than low ones.
+ *
+ * The transforms and the loops over the input and the raw transform output
+ * run in either double or single precision. Single precision halves the memory
+ * traffic of these steps and doubles the width of FFTW's SIMD code, at a small
+ * cost in accuracy.
+ *
+ * The results of each analysis are published as an immutable AnalysisFrame.
+ * The done() signal announces a new frame, which any number of readers in any
+ * thread then share through latestFrame(); the frames are recycled, so
+ * publishing them copies and allocates nothing once they have their size.
  */
 class Analyzer : public QObject
 {
     Q_OBJECT
+    friend class AnalyzerBenchmark;
 
 public:
+    // The analyzer is Processing while it follows the frames of its queue, so
+    // the state only changes when that stream starts or stops, not per frame
     enum State {
         Loading,
         Ready,
-        Processing,
-        CalibratingFilter
+        Processing
     };
+    Q_ENUM(State)
     enum WindowFunction {
         Rectangular,
         Hann,
         Gaussian
     };
+    enum Precision {
+        DoublePrecision,
+        SinglePrecision
+    };
+    // Averaging of consecutive spectra. The moving average weighs the last
+    // numSpectra spectra equally, the exponential average weighs all previous
+    // spectra with a decay of the same effective length and keeps no history.
+    enum Averaging {
+        MovingAverage,
+        ExponentialAverage
+    };
+    struct Settings
+    {
+        int sampleRate = 22050;
+        quint32 segmentLength = 4096;
+        quint32 numSpectra = 5;
+        WindowFunction windowFunction = Rectangular;
+        Precision precision = DoublePrecision;
+        Averaging averaging = MovingAverage;
+        bool enableNoiseFilter = false;
+        bool fastUpdates = false;   // Prepare for updateAnalysis()
+        bool refinePeaks = true;    // Zoom in on the first harmonics
+        bool adaptiveLength = false; // Adapt the segment length to the pitch
+        quint32 periodsPerSegment = 8;
+        qreal maxFrequency = 0;     // Decimate down to this band, 0 to disable
+        bool timeDomainFilter = false;  // Band limit the input instead of its spectrum
+        bool cancelHum = false;     // Remove 50 or 60 Hz mains hum from the input
+        qreal segmentOverlap = 0.5; // Of consecutive segments, which times the noise estimate
+    };
 
     explicit Analyzer(QObject *parent = 0);
+    explicit Analyzer(const Settings &settings, QObject *parent = 0);
     ~Analyzer();
 
     State state() const;
+    Settings settings() const;
+    // The length currently analysed, in input samples, which may be shorter
+    // than the configured one in the adaptive length mode
+    quint32 segmentLength() const;
+    // Input samples per analysed sample
+    quint32 decimation() const;
+    // Set the queue consumed by processQueue()
+    void setFrameQueue(FrameQueue *queue);
+    // The results of the last analysis or fast update, null before the first.
+    // May be called from any thread.
+    SharedAnalysisFrame latestFrame() const;
     
 signals:
     void stateChanged(State newState);
-    void done(Spectrum harmonics, Spectrum spectrum, Spectrum autocorrelation, Spectrum snacPeaks);
+    // The length of the segments to pass in changed
+    void segmentLengthChanged(quint32 length);
+    // A new frame was published. Readers that fall behind simply see the
+    // latest one.
+    void done();
     
 public slots:
-    void doAnalysis(const QAudioBuffer &input);
+    // Analyse the latest segment of the input, of which newSamples are new
+    // since the previous call and continue the stream of the decimator and
+    // the time domain filters. A negative number, or one exceeding the
+    // segment, starts the stream over.
+    void doAnalysis(const AudioView &input, qint64 newSamples = -1);
+    // Update the fundamental found by the last full analysis, given the
+    // latest segment of which newSamples are new since the previous call.
+    // Requires the fastUpdates setting.
+    void updateAnalysis(const AudioView &input, int newSamples);
+    // Analyse the queued frames as they arrive, until the queue is
+    // interrupted or aborted
+    void processQueue();
+    void setSettings(const Analyzer::Settings &settings);
     void setNoiseFilter(bool enable = true);
+    // Start the noise estimate over
     void resetFilter();
+    // Forget all previous input, as if newly constructed
+    void reset();
 
-private slots:
-    void init();
-    
 private:
+    // Transform and buffers of one precision
+    template<typename T> struct Transform
+    {
+        explicit Transform(int size) : fft(size), window(size / 2), signal(size / 2) {}
+        FftEngine<T> fft;
+        QVector<T> window;
+        QVector<T> signal;  // Copy of the preprocessed input for the SNAC
+    };
+    // Recently used transforms of one precision, most recent first. Planning
+    // is expensive, so switching back to a recent segment length reuses its
+    // transform.
+    template<typename T> using TransformCache = QVector<QSharedPointer<Transform<T>>>;
+    template<typename T> static QSharedPointer<Transform<T>> cachedTransform(TransformCache<T> &cache, int size, int capacity);
+    // Recently used responses of the filter of the spectrum, most recent
+    // first. The design of the filter is fixed, so the sample rate, bin
+    // spacing and number of bins identify a response.
+    struct FilterResponse
+    {
+        qreal sampleRate;
+        qreal binSpacing;
+        ButterworthFilter::CVector response;
+    };
+
+    void init();
+    // Switch to one of the lengths prepared by init()
+    void setSegmentLength(quint32 length);
+    void adaptSegmentLength();
+    void resampleNoiseSpectrum();
+    // Size the noise estimate's window from the hop of the current length
+    void setNoiseInterval();
+    // The last segmentLength() samples of the input
+    AudioView currentSegment(const AudioView &input) const;
+    // Read a segment for a full analysis or for a fast update, of which
+    // newSamples are new since the previous one
+    void readSegment(const AudioView &segment, qint64 newSamples);
+    void readUpdateSegment(const AudioView &segment, qint64 newSamples);
+    // Decimate, remove the hum from and filter the new samples of the
+    // segment, returning the number of samples added to m_stream. After a gap,
+    // when samples were missed or the stream was stopped, it starts over from
+    // the whole segment.
+    int readStream(const AudioView &segment, qint64 newSamples);
     void setState(State newState);
-    void calculateWindow();
-    void preProcess(const QAudioBuffer &input);
-    template<typename T> void extractAndScale(const QAudioBuffer &input);
-    void getSpectrum();
-    void getAcf();
+    template<typename T> void calculateWindow(Transform<T> &transform);
+    // Run the analysis in the selected precision
+    void analyzeInput();
+    template<typename T> void analyzeInput(Transform<T> &transform);
+    void preProcess(const AudioView &input);
+    template<typename T> void preProcess(Transform<T> &transform, const AudioView &input);
+    // Convert the samples to T, returning the number of samples converted
+    template<typename S, typename T> int extractAndScale(const AudioView &input, T *output, Preprocess::Sums &sums);
+    template<typename T> void getSpectrum(Transform<T> &transform);
+    template<typename T> void getAcf(Transform<T> &transform);
     void setFftFilter();
-    void calibrateFilter();
     void processSpectrum();
-    Spectrum computeSnac(const QVector<double> acf, const QVector<double> signal) const;
-    Tone determineSnacFundamental(const Spectrum snac) const;
-    Spectrum findHarmonics(const Spectrum spectrum, qreal fApprox) const;
+    void resetAverage();
+    void renormalizeAverage();
+    template<typename T> void computeSnac(const T *acf, const T *signal, Spectrum &snac) const;
+    Tone determineSnacFundamental(const Spectrum &snac) const;
+    void findHarmonics(const Spectrum &spectrum, qreal fApprox, QVector<Tone> &harmonics) const;
+    template<typename T> void refineHarmonics(QVector<Tone> &harmonics, const T *signal) const;
+    // Convert the last count samples of the input for the sliding DFT, or
+    // copy the last count samples of the stream when streaming
+    void readUpdateInput(const AudioView &input, int count);
+    // Convert the last count samples of the input to qreal, returning the
+    // number converted
+    int convertTail(const AudioView &input, int count, qreal *output);
+    template<typename S> void extractTail(const AudioView &input, int count, qreal *output);
+    void startTracking();
+    void analyzeUpdate();
+    // Publish the results of a full analysis, or those of the last one with
+    // an updated fundamental
+    void publishAnalysis();
+    void publishUpdate(const Tone &fundamental);
     
     State m_state;  // Execution state
-    bool m_calibrateFilter;  // Whether to calibrate a new noise filter
+    Settings m_settings;
+    FrameQueue *m_queue;
+    bool m_noiseFilter;  // Whether to estimate and subtract the noise
     quint32 m_sampleSize;  // Number of samples for spectral analysis
+    quint32 m_decimation;  // Input samples per analysed sample
     quint32 m_outputSize;  // Number of elements in the output vector
     qreal m_binFreq;
     QAudioFormat m_currentFormat;
     Spectrum m_noiseSpectrum;
-    quint32 m_numNoiseSegments; // Average over this many segments for the noise filter
-    quint32 m_filterPass;
+    NoiseEstimator m_noiseEstimator;
     ButterworthFilter::CVector m_filter;
+    QVector<FilterResponse> m_filterCache;
     
-    // DFT variables
-    QVector<double> m_window;
-    QVector<double> m_input;
-    QVector<std::complex<double>> m_output;
-    Spectrum m_spectrum;
-    fftw_plan_s *m_plan;
-    fftw_plan_s *m_ifftPlan;
+    // DFT variables, only the transform of the selected precision is set
+    QSharedPointer<Transform<double>> m_double;
+    QSharedPointer<Transform<float>> m_single;
+    TransformCache<double> m_doubleCache;
+    TransformCache<float> m_singleCache;
+    int m_cacheCapacity;
+    CompactSpectrum m_rawSpectrum;  // Spectrum of the current input
+    Spectrum m_spectrum;    // Averaged spectrum, minus the noise spectrum
     
-    // Spectral averaging
+    // Spectral averaging. The moving average keeps a running sum of the
+    // spectra in the history, which is recomputed from the history now and
+    // then to discard accumulated rounding errors. The exponential average
+    // keeps its state in the same vector and has no history.
+    Averaging m_averaging;
     quint32 m_numSpectra;
     quint32 m_currentSpectrum;
-    QVector<Spectrum> m_spectrumHistory;
+    quint32 m_numAveraged;      // Spectra in the average so far, up to m_numSpectra
+    quint32 m_sinceRenormalization;
+    QVector<CompactSpectrum> m_spectrumHistory;
+    QVector<qreal> m_average;
+
+    // Results of the last full analysis, repeated by fast updates
+    QVector<Tone> m_harmonics;
+    Spectrum m_snac;
+    QVector<Tone> m_snacPeaks;
+    AnalysisFrameSlot m_frames;
+    SharedAnalysisFrame m_lastAnalysis;     // Frame of the last full analysis
+
+    // Fast updates
+    SlidingDft m_tracker;
+    QVector<qreal> m_updateInput;
+    QVector<qreal> m_trackedFrequencies;
+    Spectrum m_trackedSpectrum;
+    int m_updateCount;          // Samples in m_updateInput
+    quint32 m_firstTrackedBin;  // Zero when not tracking
+    quint64 m_frameEnd;         // End of the last frame taken from the queue
+
+    // Adaptive segment length
+    QVector<quint32> m_segmentLengths;  // Prepared lengths, longest first
+    int m_shortenVotes;         // Consecutive analyses that asked for a shorter length
+
+    // Streaming input, decimated, freed of hum and/or filtered in the time
+    // domain
+    bool m_streaming;           // Whether the analysis reads m_stream
+    bool m_streamRunning;       // Whether the next samples continue m_stream
+    Decimator m_decimator;
+    HumCanceller m_humCanceller;
+    BiquadCascade m_inputFilter;
+    QVector<qreal> m_streamInput;   // Converted input samples to decimate
+    QVector<qreal> m_stream;        // Latest stream samples, oldest first
 };
 
+Q_DECLARE_METATYPE(Analyzer::Settings)
+
 #endif // ANALYZER_H
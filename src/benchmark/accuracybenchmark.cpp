@@ -0,0 +1,305 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the complete analysis on synthetic signals for every combination of
+// the given settings and reports accuracy, latency and cost, one line per
+// combination of settings and signal type.
+
+#include "analyzer.h"
+#include "fftengine.h"
+#include "signalgenerator.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QTextStream>
+
+#include <cmath>
+#include <algorithm>
+#include <ctime>
+#include <numeric>
+
+namespace {
+    // Consecutive readings within tolerance that count as a stable reading
+    const int StableReadings = 3;
+
+    struct Options
+    {
+        QVector<int> lengths {1024, 2048, 4096, 8192, 16384};
+        QVector<int> windows {Analyzer::Rectangular, Analyzer::Hann, Analyzer::Gaussian};
+        QVector<int> precisions {Analyzer::DoublePrecision, Analyzer::SinglePrecision};
+        QVector<int> numSpectra {1, 5, 10};
+        QVector<int> averaging {Analyzer::MovingAverage, Analyzer::ExponentialAverage};
+        QVector<int> periods {0};   // Periods per adaptive segment, 0 for a fixed length
+        QVector<int> maxFrequencies {0};    // Highest frequency kept by decimation, 0 for none
+        QVector<int> timeDomainFilters {0};
+        QVector<int> cancelHum {0};
+        QVector<int> sampleRates {22050, 44100, 48000};
+        QVector<qreal> frequencies {41.2, 82.41, 110.0, 146.83, 196.0, 246.94, 329.63, 440.0, 659.26, 987.77};
+        qreal duration = 2;
+        qreal overlap = 0.5;
+        qreal tolerance = 1;    // In cents
+        bool json = false;
+    };
+
+    struct Measurement
+    {
+        QVector<qreal> errors;      // Absolute errors of the readings, in cents
+        int frames = 0;
+        qreal hopTime = 0;          // Sum of the times between frames, in seconds
+        int missing = 0;            // Frames without a reading
+        int octaveErrors = 0;
+        QVector<qreal> stableTimes; // Time to the first stable reading, per run
+        int unstableRuns = 0;       // Runs without a stable reading
+        qreal cpuTime = 0;          // In seconds
+    };
+
+    template<typename T> QVector<T> parseList(const QString &list)
+    {
+        QVector<T> result;
+        for (const auto &item : list.split(QLatin1Char(','), QString::SkipEmptyParts))
+            result << T(item.toDouble());
+        return result;
+    }
+
+    qreal percentile(QVector<qreal> values, qreal fraction)
+    {
+        if (values.isEmpty())
+            return 0;
+        const int index = std::min<int>(values.size() - 1, fraction * values.size());
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values.at(index);
+    }
+
+    qreal mean(const QVector<qreal> &values)
+    {
+        return values.isEmpty() ? 0 : std::accumulate(values.constBegin(), values.constEnd(), 0.0) / values.size();
+    }
+
+    // Analyse one signal from start to end with a fresh analyzer
+    void analyzeRun(const Analyzer::Settings &settings, const QByteArray &samples, qreal expected, const Options &options, Measurement &m)
+    {
+        Analyzer analyzer(settings);
+        AudioView view;
+        view.format.setSampleRate(settings.sampleRate);
+        view.format.setSampleSize(16);
+        view.format.setChannelCount(1);
+        view.format.setSampleType(QAudioFormat::SignedInt);
+
+        // Segments are passed at the configured length, but follow each other
+        // at the hop of the length the analyzer currently uses
+        const qint64 length = settings.segmentLength;
+        const auto hopFor = [&](qint64 l) { return std::max<qint64>(1, l * (1 - options.overlap)); };
+        qint64 hop = hopFor(analyzer.segmentLength());
+        const qint64 sampleCount = samples.size() / sizeof(qint16);
+        qreal frequency = 0;
+        QObject::connect(&analyzer, &Analyzer::done, [&] {
+            const auto frame = analyzer.latestFrame();
+            const auto &harmonics = frame->harmonics();
+            frequency = harmonics.isEmpty() ? 0 : harmonics.first().frequency;
+        });
+        QObject::connect(&analyzer, &Analyzer::segmentLengthChanged, [&](quint32 l) { hop = hopFor(l); });
+
+        int inTolerance = 0;
+        qreal firstInTolerance = 0;
+        bool stable = false;
+        qint64 previousStart = -1;
+        for (qint64 start = 0; start + length <= sampleCount; start += hop) {
+            view.data[0] = samples.constData() + start * sizeof(qint16);
+            view.size[0] = length * sizeof(qint16);
+            frequency = 0;
+            const auto clockStart = std::clock();
+            analyzer.doAnalysis(view, previousStart < 0 ? -1 : start - previousStart);
+            previousStart = start;
+            m.cpuTime += qreal(std::clock() - clockStart) / CLOCKS_PER_SEC;
+            ++m.frames;
+            m.hopTime += qreal(hop) / settings.sampleRate;
+
+            if (frequency <= 0) {
+                ++m.missing;
+                inTolerance = 0;
+                continue;
+            }
+            const qreal cents = 1200 * std::log2(frequency / expected);
+            m.errors << std::abs(cents);
+            if (qRound(cents / 1200) != 0)
+                ++m.octaveErrors;
+            inTolerance = std::abs(cents) <= options.tolerance ? inTolerance + 1 : 0;
+            // Report the time at which the first of the stable readings
+            // became available
+            if (inTolerance == 1)
+                firstInTolerance = qreal(start + length) / settings.sampleRate;
+            if (!stable && inTolerance == StableReadings) {
+                stable = true;
+                m.stableTimes << firstInTolerance;
+            }
+        }
+        if (!stable)
+            ++m.unstableRuns;
+    }
+
+    void report(QTextStream &out, const Options &options, const Analyzer::Settings &settings, const QString &signal, const Measurement &m)
+    {
+        static const QStringList windowNames {QStringLiteral("rectangular"), QStringLiteral("hann"), QStringLiteral("gaussian")};
+        const auto window = windowNames.value(settings.windowFunction);
+        const auto precision = settings.precision == Analyzer::SinglePrecision ? QStringLiteral("single") : QStringLiteral("double");
+        const auto averaging = settings.averaging == Analyzer::ExponentialAverage ? QStringLiteral("exponential") : QStringLiteral("moving");
+        const qreal readings = qMax(1, m.errors.size());
+        const qreal frames = qMax(1, m.frames);
+        const auto stableTime = m.stableTimes.isEmpty() ? QString() : QString::number(mean(m.stableTimes), 'f', 4);
+        const QStringList values {
+            QString::number(settings.sampleRate), QString::number(settings.segmentLength), window, precision,
+            QString::number(settings.numSpectra), averaging,
+            QString::number(settings.adaptiveLength ? settings.periodsPerSegment : 0), QString::number(settings.maxFrequency),
+            QString::number(settings.timeDomainFilter), QString::number(settings.cancelHum), signal, QString::number(m.frames),
+            QString::number(1e3 * m.hopTime / frames, 'f', 2),
+            QString::number(mean(m.errors), 'f', 3), QString::number(percentile(m.errors, 0.95), 'f', 3),
+            QString::number(m.octaveErrors / readings, 'f', 4), QString::number(m.missing / frames, 'f', 4),
+            stableTime, QString::number(m.unstableRuns), QString::number(1e6 * m.cpuTime / frames, 'f', 1)
+        };
+        static const QStringList keys {
+            QStringLiteral("sample_rate"), QStringLiteral("segment_length"), QStringLiteral("window"),
+            QStringLiteral("precision"), QStringLiteral("num_spectra"), QStringLiteral("averaging"), QStringLiteral("periods"),
+            QStringLiteral("max_frequency"), QStringLiteral("time_domain_filter"), QStringLiteral("cancel_hum"), QStringLiteral("signal"), QStringLiteral("frames"), QStringLiteral("mean_hop_ms"),
+            QStringLiteral("mean_abs_cents"), QStringLiteral("p95_abs_cents"),
+            QStringLiteral("octave_error_rate"), QStringLiteral("missing_rate"),
+            QStringLiteral("time_to_stable"), QStringLiteral("unstable_runs"), QStringLiteral("cpu_us_per_frame")
+        };
+        if (options.json) {
+            QStringList fields;
+            for (int i = 0; i < keys.size(); ++i) {
+                const bool isString = i == 2 || i == 3 || i == 5 || i == 10;
+                const auto value = values.at(i).isEmpty() ? QStringLiteral("null") : values.at(i);
+                fields << QStringLiteral("\"%1\":%2").arg(keys.at(i), isString ? QLatin1Char('"') + value + QLatin1Char('"') : value);
+            }
+            out << '{' << fields.join(QLatin1Char(',')) << "}\n";
+        } else {
+            static bool header = true;
+            if (header)
+                out << keys.join(QLatin1Char(',')) << '\n';
+            header = false;
+            out << values.join(QLatin1Char(',')) << '\n';
+        }
+        out.flush();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("ktuner-accuracy"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measure accuracy, latency and cost of KTuner's analysis on synthetic signals."));
+    parser.addHelpOption();
+    const QCommandLineOption formatOption(QStringLiteral("output"), QStringLiteral("Output format, csv or json (one object per line)."), QStringLiteral("format"), QStringLiteral("csv"));
+    const QCommandLineOption lengthsOption(QStringLiteral("lengths"), QStringLiteral("Comma separated segment lengths."), QStringLiteral("list"));
+    const QCommandLineOption windowsOption(QStringLiteral("windows"), QStringLiteral("Comma separated window functions (0 rectangular, 1 Hann, 2 Gaussian)."), QStringLiteral("list"));
+    const QCommandLineOption precisionsOption(QStringLiteral("precisions"), QStringLiteral("Comma separated precisions (0 double, 1 single)."), QStringLiteral("list"));
+    const QCommandLineOption spectraOption(QStringLiteral("num-spectra"), QStringLiteral("Comma separated numbers of averaged spectra."), QStringLiteral("list"));
+    const QCommandLineOption averagingOption(QStringLiteral("averaging"), QStringLiteral("Comma separated averaging methods (0 moving, 1 exponential)."), QStringLiteral("list"));
+    const QCommandLineOption periodsOption(QStringLiteral("periods"), QStringLiteral("Comma separated periods per segment of the adaptive length mode, 0 for a fixed length."), QStringLiteral("list"));
+    const QCommandLineOption maxFrequenciesOption(QStringLiteral("max-frequencies"), QStringLiteral("Comma separated highest frequencies kept by decimation, 0 for the full band."), QStringLiteral("list"));
+    const QCommandLineOption timeFiltersOption(QStringLiteral("time-domain-filters"), QStringLiteral("Comma separated filter placements (0 spectrum, 1 audio stream)."), QStringLiteral("list"));
+    const QCommandLineOption humOption(QStringLiteral("cancel-hum"), QStringLiteral("Comma separated hum cancelling choices (0 off, 1 on)."), QStringLiteral("list"));
+    const QCommandLineOption ratesOption(QStringLiteral("rates"), QStringLiteral("Comma separated sample rates."), QStringLiteral("list"));
+    const QCommandLineOption frequenciesOption(QStringLiteral("frequencies"), QStringLiteral("Comma separated test pitches in Hz."), QStringLiteral("list"));
+    const QCommandLineOption durationOption(QStringLiteral("duration"), QStringLiteral("Length of each test signal."), QStringLiteral("seconds"), QStringLiteral("2"));
+    const QCommandLineOption overlapOption(QStringLiteral("overlap"), QStringLiteral("Overlap of consecutive segments."), QStringLiteral("fraction"), QStringLiteral("0.5"));
+    const QCommandLineOption toleranceOption(QStringLiteral("tolerance"), QStringLiteral("Error in cents below which a reading counts as correct."), QStringLiteral("cents"), QStringLiteral("1"));
+    parser.addOptions({formatOption, lengthsOption, windowsOption, precisionsOption, spectraOption, averagingOption, periodsOption, maxFrequenciesOption, timeFiltersOption, humOption, ratesOption, frequenciesOption,
+                       durationOption, overlapOption, toleranceOption});
+    parser.process(app);
+    FftPlanner::setBackgroundPlanning(false);
+
+    Options options;
+    if (parser.isSet(lengthsOption))
+        options.lengths = parseList<int>(parser.value(lengthsOption));
+    if (parser.isSet(windowsOption))
+        options.windows = parseList<int>(parser.value(windowsOption));
+    if (parser.isSet(precisionsOption))
+        options.precisions = parseList<int>(parser.value(precisionsOption));
+    if (parser.isSet(spectraOption))
+        options.numSpectra = parseList<int>(parser.value(spectraOption));
+    if (parser.isSet(averagingOption))
+        options.averaging = parseList<int>(parser.value(averagingOption));
+    if (parser.isSet(periodsOption))
+        options.periods = parseList<int>(parser.value(periodsOption));
+    if (parser.isSet(maxFrequenciesOption))
+        options.maxFrequencies = parseList<int>(parser.value(maxFrequenciesOption));
+    if (parser.isSet(timeFiltersOption))
+        options.timeDomainFilters = parseList<int>(parser.value(timeFiltersOption));
+    if (parser.isSet(humOption))
+        options.cancelHum = parseList<int>(parser.value(humOption));
+    if (parser.isSet(ratesOption))
+        options.sampleRates = parseList<int>(parser.value(ratesOption));
+    if (parser.isSet(frequenciesOption))
+        options.frequencies = parseList<qreal>(parser.value(frequenciesOption));
+    options.duration = parser.value(durationOption).toDouble();
+    options.overlap = qBound(0.0, parser.value(overlapOption).toDouble(), 0.9);
+    options.tolerance = parser.value(toleranceOption).toDouble();
+    options.json = parser.value(formatOption) == QLatin1String("json");
+
+    QTextStream out(stdout);
+    for (const auto rate : options.sampleRates) {
+        // Generate the signals once per sample rate
+        const SignalGenerator generator(rate);
+        QVector<QVector<QByteArray>> signalData;
+        for (const auto type : SignalGenerator::signalTypes()) {
+            QVector<QByteArray> bySignal;
+            for (const auto f : options.frequencies)
+                bySignal << generator.generate(type, f, options.duration);
+            signalData << bySignal;
+        }
+
+        for (const auto length : options.lengths)
+        for (const auto window : options.windows)
+        for (const auto precision : options.precisions)
+        for (const auto spectra : options.numSpectra)
+        for (const auto averaging : options.averaging)
+        for (const auto periods : options.periods)
+        for (const auto maxFrequency : options.maxFrequencies)
+        for (const auto timeDomainFilter : options.timeDomainFilters)
+        for (const auto cancelHum : options.cancelHum) {
+            Analyzer::Settings settings;
+            settings.sampleRate = rate;
+            settings.segmentLength = length;
+            settings.windowFunction = Analyzer::WindowFunction(window);
+            settings.precision = Analyzer::Precision(precision);
+            settings.numSpectra = std::max(1, spectra);
+            settings.averaging = Analyzer::Averaging(averaging);
+            settings.adaptiveLength = periods > 0;
+            settings.periodsPerSegment = std::max(1, periods);
+            settings.maxFrequency = std::max(0, maxFrequency);
+            settings.timeDomainFilter = timeDomainFilter != 0;
+            settings.cancelHum = cancelHum != 0;
+            settings.segmentOverlap = options.overlap;
+            const auto types = SignalGenerator::signalTypes();
+            for (int s = 0; s < types.size(); ++s) {
+                Measurement m;
+                for (int i = 0; i < options.frequencies.size(); ++i) {
+                    const auto expected = SignalGenerator::expectedFrequency(types.at(s), options.frequencies.at(i));
+                    analyzeRun(settings, signalData.at(s).at(i), expected, options, m);
+                }
+                report(out, options, settings, SignalGenerator::name(types.at(s)), m);
+            }
+        }
+    }
+    return 0;
+}
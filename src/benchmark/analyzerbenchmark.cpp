@@ -0,0 +1,575 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times each stage of the analysis pipeline for a range of segment lengths and
+// prints the results as CSV or JSON lines, one line per measurement. With
+// --check-allocations, it instead counts the heap allocations of steady-state
+// analyses and fails if there are any. Those analyses run as in the tuner: in
+// a thread of their own, fed through a FrameQueue, while another thread reads
+// the published frames.
+
+#include "analyzer.h"
+#include "butterworthfilter.h"
+#include "fftengine.h"
+#include "framequeue.h"
+#include "ringbuffer.h"
+#include "spectrum.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+
+#include <math.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <numeric>
+#include <vector>
+
+namespace {
+    // Heap allocations of all threads while counting is on, so that those of
+    // the analyzer thread, of the queue and of the readers are all included
+    std::atomic<bool> countAllocations(false);
+    std::atomic<qint64> allocationCount(0);
+
+    inline void countAllocation()
+    {
+        if (countAllocations.load(std::memory_order_relaxed))
+            allocationCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Reads the latest frame of an analyzer from another thread and holds on
+    // to it, polling at about the display rate of the tuner
+    class FrameReader : public QThread
+    {
+    public:
+        explicit FrameReader(const Analyzer &analyzer) : m_analyzer(analyzer), m_stopped(false) {}
+        void stop()
+        {
+            m_stopped = true;
+            wait();
+        }
+
+    protected:
+        void run() override
+        {
+            SharedAnalysisFrame frame;
+            while (!m_stopped) {
+                frame = m_analyzer.latestFrame();
+                msleep(16);
+            }
+        }
+
+    private:
+        const Analyzer &m_analyzer;
+        std::atomic<bool> m_stopped;
+    };
+    // The preprocessing as it was before the fused kernels, for comparison:
+    // separate passes to clear the buffer, convert, sum and fit over the whole
+    // padded buffer, and subtract the fit and apply the window
+    template<typename T>
+    void referencePreProcess(const qint16 *input, int length, const T *window, T *data)
+    {
+        const int size = 2 * length;
+        std::fill(data, data + size, T(0));
+        const T scale = std::pow(2, 15);
+        for (int i = 0; i < length; ++i)
+            data[i] = input[i] / scale;
+
+        const auto xMean = 0.5 * (length + 1);
+        const auto yMean = std::accumulate(data, data + length, 0.0) / length;
+        qreal covXY = 0;
+        qreal varX = 0;
+        for (int x = 0; x < size; ++x) {
+            const auto dx = x - xMean;
+            covXY += dx * (data[x] - yMean);
+            varX += dx * dx;
+        }
+        const auto a = covXY / varX;
+        const auto b = yMean - a * xMean;
+        for (int x = 0; x < size; ++x)
+            data[x] = (x < length ? window[x] : 0) * (data[x] - T(a * x + b));
+    }
+}
+
+// Count every allocation through malloc, which Qt's containers use directly,
+// and through operator new, which uses malloc on glibc but may not elsewhere
+#ifdef __GLIBC__
+extern "C" {
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *pointer, size_t size);
+
+    void *malloc(size_t size)
+    {
+        countAllocation();
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        countAllocation();
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *pointer, size_t size)
+    {
+        countAllocation();
+        return __libc_realloc(pointer, size);
+    }
+}
+#else
+void *operator new(std::size_t size)
+{
+    countAllocation();
+    if (void *pointer = malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    free(pointer);
+}
+#endif
+
+class AnalyzerBenchmark
+{
+public:
+    AnalyzerBenchmark(const QVector<int> &lengths, qint64 minimumTime, bool json);
+    void run();
+    // Count the allocations of steady-state analyses for each length and
+    // precision in several configurations, returning whether there were none
+    bool checkAllocations();
+
+private:
+    template<typename T> QByteArray generateInput(int length) const;
+    AudioView view(const QByteArray &data, int sampleSize) const;
+    template<typename T> void benchmarkLength(int length, Analyzer::Precision precision);
+    // Time function by repeating it until the minimum time has passed
+    template<typename Function> void measure(const char *stage, int length, int parameter, Function function);
+    // Allocations per frame once an analyzer with these settings has warmed
+    // up, feeding it frames through its queue
+    qint64 countFrameAllocations(const Analyzer::Settings &settings);
+
+    // The transform of the analyzer for the given precision
+    static Analyzer::Transform<double> &transform(Analyzer &analyzer, double) { return *analyzer.m_double; }
+    static Analyzer::Transform<float> &transform(Analyzer &analyzer, float) { return *analyzer.m_single; }
+
+    const QVector<int> m_lengths;
+    const qint64 m_minimumTime;
+    const bool m_json;
+    const int m_sampleRate;
+    const char *m_precision;
+    QTextStream m_out;
+};
+
+AnalyzerBenchmark::AnalyzerBenchmark(const QVector<int> &lengths, qint64 minimumTime, bool json)
+    : m_lengths(lengths)
+    , m_minimumTime(minimumTime)
+    , m_json(json)
+    , m_sampleRate(44100)
+    , m_precision("")
+    , m_out(stdout)
+{
+}
+
+void AnalyzerBenchmark::run()
+{
+    if (!m_json)
+        m_out << "stage,segment_length,precision,parameter,iterations,ns_per_iteration\n";
+    for (const auto length : m_lengths) {
+        benchmarkLength<double>(length, Analyzer::DoublePrecision);
+        benchmarkLength<float>(length, Analyzer::SinglePrecision);
+    }
+}
+
+// A plucked string at 110 Hz, decaying harmonics and a little noise
+template<typename T>
+QByteArray AnalyzerBenchmark::generateInput(int length) const
+{
+    QByteArray data(length * sizeof(T), 0);
+    auto sample = reinterpret_cast<T*>(data.data());
+    const qreal amplitude = 0.25 * std::pow(2, 8 * sizeof(T) - 1);
+    quint32 seed = 1;
+    for (int i = 0; i < length; ++i) {
+        qreal value = 0;
+        for (int h = 1; h <= 8; ++h)
+            value += std::sin(2 * M_PI * 110 * h * i / m_sampleRate) / h;
+        seed = seed * 1664525 + 1013904223;
+        value += 0.01 * (qreal(seed) / 0xffffffff - 0.5);
+        sample[i] = T(amplitude * value / 2);
+    }
+    return data;
+}
+
+AudioView AnalyzerBenchmark::view(const QByteArray &data, int sampleSize) const
+{
+    AudioView view;
+    view.format.setSampleRate(m_sampleRate);
+    view.format.setSampleSize(sampleSize);
+    view.format.setChannelCount(1);
+    view.format.setSampleType(QAudioFormat::SignedInt);
+    view.data[0] = data.constData();
+    view.size[0] = data.size();
+    return view;
+}
+
+template<typename T>
+void AnalyzerBenchmark::benchmarkLength(int length, Analyzer::Precision precision)
+{
+    m_precision = precision == Analyzer::SinglePrecision ? "single" : "double";
+    Analyzer::Settings settings;
+    settings.sampleRate = m_sampleRate;
+    settings.segmentLength = length;
+    settings.precision = precision;
+    Analyzer analyzer(settings);
+    auto &data = transform(analyzer, T());
+
+    const QByteArray input8 = generateInput<qint8>(length);
+    const QByteArray input16 = generateInput<qint16>(length);
+    const QByteArray input32 = generateInput<qint32>(length);
+    const auto input = view(input16, 16);
+
+    measure("doAnalysis", length, 0, [&]{ analyzer.doAnalysis(input); });
+    // The streaming modes continue their stream with a hop of half a segment
+    const int hop = length / 2;
+    // The same segment decimated to keep the band up to 2 kHz, with the
+    // decimation factor as parameter
+    auto decimated = settings;
+    decimated.maxFrequency = 2000;
+    analyzer.setSettings(decimated);
+    const int factor = analyzer.decimation();
+    measure("doAnalysisDecimated", length, factor, [&]{ analyzer.doAnalysis(input, hop); });
+    measure("decimate", length, factor, [&]{ analyzer.readStream(input, length); });
+    // Band limiting the stream in the time domain instead of the spectrum,
+    // with the number of sections as parameter
+    auto filtered = settings;
+    filtered.timeDomainFilter = true;
+    analyzer.setSettings(filtered);
+    measure("doAnalysisFiltered", length, 0, [&]{ analyzer.doAnalysis(input, hop); });
+    std::vector<qreal> stream(length, 0.0);
+    measure("timeDomainFilter", length, analyzer.m_inputFilter.size(), [&]{
+        analyzer.m_inputFilter.process(stream.data(), length);
+    });
+    // Removing mains hum from the stream, with the number of cancelled
+    // harmonics as parameter
+    auto humFree = settings;
+    humFree.cancelHum = true;
+    analyzer.setSettings(humFree);
+    measure("doAnalysisHumCancelled", length, 0, [&]{ analyzer.doAnalysis(input, hop); });
+    measure("cancelHum", length, HumCanceller::Harmonics, [&]{
+        analyzer.m_humCanceller.process(stream.data(), length);
+    });
+    analyzer.setSettings(settings);
+    measure("preProcess", length, 8, [&]{ analyzer.preProcess(data, view(input8, 8)); });
+    measure("preProcess", length, 32, [&]{ analyzer.preProcess(data, view(input32, 32)); });
+    measure("preProcess", length, 16, [&]{ analyzer.preProcess(data, input); });
+    measure("preProcessReference", length, 16, [&]{
+        referencePreProcess(reinterpret_cast<const qint16*>(input16.constData()), length, data.window.constData(), data.fft.input());
+    });
+    analyzer.preProcess(data, input);
+    const std::vector<T> signal(data.fft.input(), data.fft.input() + length);
+    measure("getSpectrum", length, 0, [&]{ analyzer.getSpectrum(data); });
+    for (const quint32 numSpectra : {1, 5, 20, 50}) {
+        settings.numSpectra = numSpectra;
+        analyzer.setSettings(settings);
+        measure("processSpectrum", length, numSpectra, [&]{ analyzer.processSpectrum(); });
+    }
+    settings.averaging = Analyzer::ExponentialAverage;
+    analyzer.setSettings(settings);
+    measure("processSpectrumExponential", length, settings.numSpectra, [&]{ analyzer.processSpectrum(); });
+    settings.averaging = Analyzer::MovingAverage;
+    analyzer.setSettings(settings);
+    measure("getAcf", length, 0, [&]{ analyzer.getAcf(data); });
+    const std::vector<T> acf(data.fft.input(), data.fft.input() + length);
+
+    Spectrum snac;
+    measure("computeSnac", length, 0, [&]{ analyzer.computeSnac(acf.data(), signal.data(), snac); });
+    Tone snacPeak;
+    measure("determineSnacFundamental", length, 0, [&]{ snacPeak = analyzer.determineSnacFundamental(snac); });
+    const qreal fApprox = snacPeak.frequency > 0 ? m_sampleRate / snacPeak.frequency : 0;
+
+    // Use an averaged spectrum of the same signal for the peak searches
+    analyzer.doAnalysis(input);
+    const auto spectrum = analyzer.m_spectrum;
+    measure("findPeaks", length, 0, [&]{ spectrum.findPeaks(0.01); });
+    // The search used by findHarmonics, into fixed storage, with the number
+    // of kept peaks as parameter
+    measure("findHighestPeaks", length, 32, [&]{
+        int peaks[32];
+        spectrum.findHighestPeaks(peaks, 32, 0.01);
+    });
+    // Points for the spectrum chart, all of them and reduced to a chart 500
+    // pixels wide showing the first 1000 Hz, with the width as parameter
+    measure("chartPoints", length, 0, [&]{ QVector<QPointF> points(spectrum); });
+    measure("chartPointsReduced", length, 500, [&]{ spectrum.toPoints(0, 1000, 500); });
+    QVector<Tone> harmonics;
+    measure("findHarmonics", length, 0, [&]{ analyzer.findHarmonics(spectrum, fApprox, harmonics); });
+    measure("refineHarmonics", length, harmonics.size(), [&]{
+        auto refined = harmonics;
+        analyzer.refineHarmonics(refined, signal.data());
+    });
+
+    const ButterworthFilter filter(75, 15000, 4, qreal(m_sampleRate));
+    const qreal binFreq = qreal(m_sampleRate) / (2 * length);
+    ButterworthFilter::CVector response(length + 1);
+    measure("filterResponse", length, 0, [&]{
+        for (int i = 0; i <= length; ++i)
+            filter(i * binFreq);
+    });
+    measure("filterResponseBatch", length, 0, [&]{ filter.response(binFreq, length + 1, response.data()); });
+    measure("setFftFilter", length, 0, [&]{ analyzer.setFftFilter(); });
+    measure("setFftFilterUncached", length, 0, [&]{
+        analyzer.m_filterCache.clear();
+        analyzer.setFftFilter();
+    });
+
+    // Reconfiguration between two recently used lengths, which reuses their
+    // transforms
+    auto shorter = settings;
+    shorter.segmentLength = length / 2;
+    measure("switchLength", length, length / 2, [&]{
+        analyzer.setSettings(shorter);
+        analyzer.setSettings(settings);
+    });
+    // Switching of the adaptive mode between prepared lengths
+    auto adaptive = settings;
+    adaptive.adaptiveLength = true;
+    analyzer.setSettings(adaptive);
+    if (analyzer.m_segmentLengths.size() > 1) {
+        const auto shorterLength = analyzer.m_segmentLengths.at(1);
+        measure("adaptLength", length, shorterLength, [&]{
+            analyzer.setSegmentLength(shorterLength);
+            analyzer.setSegmentLength(length);
+        });
+    }
+    analyzer.setSettings(settings);
+
+    // Fast update after a hop of 256 samples, to compare with doAnalysis.
+    // Repeating the same hop may move the peak out of the tracked bins, so
+    // tracking is kept alive between iterations.
+    settings.fastUpdates = true;
+    analyzer.setSettings(settings);
+    analyzer.doAnalysis(input);
+    const auto firstTrackedBin = analyzer.m_firstTrackedBin;
+    measure("updateAnalysis", length, 256, [&]{
+        analyzer.m_firstTrackedBin = firstTrackedBin;
+        analyzer.updateAnalysis(input, 256);
+    });
+}
+
+bool AnalyzerBenchmark::checkAllocations()
+{
+    struct Configuration
+    {
+        const char *name;
+        std::function<void(Analyzer::Settings &)> apply;
+    };
+    const QVector<Configuration> configurations {
+        {"default", [](Analyzer::Settings &) {}},
+        {"noiseFilter", [](Analyzer::Settings &s) { s.enableNoiseFilter = true; }},
+        {"exponentialAverage", [](Analyzer::Settings &s) { s.averaging = Analyzer::ExponentialAverage; }},
+        {"decimated", [](Analyzer::Settings &s) { s.maxFrequency = 2000; }},
+        {"timeDomainFilter", [](Analyzer::Settings &s) { s.timeDomainFilter = true; }},
+        {"cancelHum", [](Analyzer::Settings &s) { s.cancelHum = true; }},
+        {"adaptiveLength", [](Analyzer::Settings &s) { s.adaptiveLength = true; }},
+        {"fastUpdates", [](Analyzer::Settings &s) { s.fastUpdates = true; }}
+    };
+
+    bool passed = true;
+    if (!m_json)
+        m_out << "configuration,segment_length,precision,allocations_per_frame\n";
+    for (const auto length : m_lengths)
+    for (const auto precision : {Analyzer::DoublePrecision, Analyzer::SinglePrecision})
+    for (const auto &configuration : configurations) {
+        m_precision = precision == Analyzer::SinglePrecision ? "single" : "double";
+        Analyzer::Settings settings;
+        settings.sampleRate = m_sampleRate;
+        settings.segmentLength = length;
+        settings.precision = precision;
+        configuration.apply(settings);
+        const qint64 allocations = countFrameAllocations(settings);
+        passed = passed && allocations == 0;
+        if (m_json)
+            m_out << "{\"configuration\":\"" << configuration.name << "\",\"segment_length\":" << length
+                  << ",\"precision\":\"" << m_precision << "\",\"allocations_per_frame\":" << allocations << "}\n";
+        else
+            m_out << configuration.name << ',' << length << ',' << m_precision << ',' << allocations << '\n';
+        m_out.flush();
+    }
+    return passed;
+}
+
+qint64 AnalyzerBenchmark::countFrameAllocations(const Analyzer::Settings &settings)
+{
+    // The first frames size the buffers that depend on the input
+    const int warmUpFrames = 4;
+    const int countedFrames = 8;
+    const int updateHop = 256;
+    const qint64 length = settings.segmentLength;
+    const qint64 hop = length / 2;
+    const bool updates = settings.fastUpdates && hop > updateHop;
+
+    // The producer blocks on a full queue, so the buffer only needs to hold
+    // the frames in the queue, the one being analysed and the next hop
+    FrameQueue queue(4, FrameQueue::Block);
+    const QByteArray data = generateInput<qint16>(2 * length);
+    const qint64 segmentBytes = length * sizeof(qint16);
+    const QSharedPointer<RingBuffer> buffer(new RingBuffer(8 * segmentBytes, view(data, 16).format));
+    QThread thread;
+    Analyzer analyzer(settings);
+    analyzer.setFrameQueue(&queue);
+    analyzer.moveToThread(&thread);
+    // Called in the analyzer thread after each full analysis
+    std::atomic<int> analysed(0);
+    QObject::connect(&analyzer, &Analyzer::done, [&analysed] { ++analysed; });
+    thread.start();
+    FrameReader reader(analyzer);
+    reader.start();
+    // The window follows the state of the analyzer through a queued
+    // connection, which posts an event each time the state changes
+    QObject::connect(&analyzer, &Analyzer::stateChanged, &reader, [](Analyzer::State) {}, Qt::QueuedConnection);
+
+    // Write the next samples of the looped input and queue a frame ending
+    // there, waking the analyzer if it is not waiting for frames already
+    qint64 source = 0;
+    const auto write = [&](qint64 samples) {
+        qint64 bytes = samples * sizeof(qint16);
+        while (bytes > 0) {
+            qint64 size = std::min<qint64>(bytes, data.size() - source);
+            char *target = buffer->writePointer(size);
+            std::copy(data.constData() + source, data.constData() + source + size, target);
+            buffer->commit(size);
+            source = (source + size) % data.size();
+            bytes -= size;
+        }
+    };
+    const auto push = [&](bool update) {
+        AudioFrame frame;
+        frame.buffer = buffer;
+        frame.position = buffer->writePosition() - segmentBytes;
+        frame.size = segmentBytes;
+        frame.update = update;
+        if (queue.push(frame))
+            QMetaObject::invokeMethod(&analyzer, "processQueue", Qt::QueuedConnection);
+    };
+    // One frame is a hop with a fast update halfway, if enabled. The full
+    // analysis comes last, so that once it is done the whole frame is.
+    const auto frame = [&] {
+        if (updates) {
+            write(updateHop);
+            push(true);
+            write(hop - updateHop);
+        } else {
+            write(hop);
+        }
+        push(false);
+    };
+    const auto waitFor = [&](int frames) {
+        while (analysed < frames)
+            QThread::yieldCurrentThread();
+    };
+
+    write(length);
+    for (int i = 0; i < warmUpFrames; ++i)
+        frame();
+    waitFor(warmUpFrames);
+    allocationCount = 0;
+    countAllocations = true;
+    for (int i = 0; i < countedFrames; ++i)
+        frame();
+    waitFor(warmUpFrames + countedFrames);
+    countAllocations = false;
+
+    reader.stop();
+    queue.abort();
+    thread.quit();
+    thread.wait();
+    return (allocationCount + countedFrames - 1) / countedFrames;
+}
+
+template<typename Function>
+void AnalyzerBenchmark::measure(const char *stage, int length, int parameter, Function function)
+{
+    function();
+    qint64 iterations = 1;
+    qint64 elapsed = 0;
+    QElapsedTimer timer;
+    forever {
+        timer.start();
+        for (qint64 i = 0; i < iterations; ++i)
+            function();
+        elapsed = timer.nsecsElapsed();
+        if (elapsed >= m_minimumTime * 1000000)
+            break;
+        iterations *= 2;
+    }
+    const qreal perIteration = qreal(elapsed) / iterations;
+    if (m_json)
+        m_out << "{\"stage\":\"" << stage << "\",\"segment_length\":" << length
+              << ",\"precision\":\"" << m_precision << "\",\"parameter\":" << parameter << ",\"iterations\":" << iterations
+              << ",\"ns_per_iteration\":" << QString::number(perIteration, 'f', 1) << "}\n";
+    else
+        m_out << stage << ',' << length << ',' << m_precision << ',' << parameter << ',' << iterations << ','
+              << QString::number(perIteration, 'f', 1) << '\n';
+    m_out.flush();
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("ktuner-benchmark"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Time the stages of KTuner's analysis pipeline."));
+    parser.addHelpOption();
+    const QCommandLineOption formatOption(QStringLiteral("output"), QStringLiteral("Output format, csv or json (one object per line)."), QStringLiteral("format"), QStringLiteral("csv"));
+    const QCommandLineOption lengthsOption(QStringLiteral("lengths"), QStringLiteral("Comma separated segment lengths, 256 to 65536 by default."), QStringLiteral("list"));
+    const QCommandLineOption timeOption(QStringLiteral("min-time"), QStringLiteral("Minimum duration of each measurement."), QStringLiteral("ms"), QStringLiteral("100"));
+    const QCommandLineOption allocationsOption(QStringLiteral("check-allocations"), QStringLiteral("Count the heap allocations of steady-state analyses instead, failing if there are any."));
+    parser.addOptions({formatOption, lengthsOption, timeOption, allocationsOption});
+    parser.process(app);
+    // Time the measured plans rather than the estimates they replace
+    FftPlanner::setBackgroundPlanning(false);
+
+    QVector<int> lengths;
+    if (parser.isSet(lengthsOption)) {
+        for (const auto &length : parser.value(lengthsOption).split(QLatin1Char(',')))
+            lengths << length.toInt();
+    } else {
+        for (int length = 256; length <= 65536; length *= 2)
+            lengths << length;
+    }
+
+    AnalyzerBenchmark benchmark(lengths, parser.value(timeOption).toLongLong(), parser.value(formatOption) == QLatin1String("json"));
+    if (parser.isSet(allocationsOption))
+        return benchmark.checkAllocations() ? 0 : 1;
+    benchmark.run();
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "signalgenerator.h"
+
+#include <math.h>
+#include <algorithm>
+
+const qreal SignalGenerator::Inharmonicity = 0.0004;
+
+namespace {
+    // Approximately normal noise with unit variance from a linear
+    // congruential generator
+    inline qreal gaussianNoise(quint32 &state)
+    {
+        qreal sum = 0;
+        for (int i = 0; i < 12; ++i) {
+            state = state * 1664525 + 1013904223;
+            sum += qreal(state) / 0xffffffff;
+        }
+        return sum - 6;
+    }
+}
+
+SignalGenerator::SignalGenerator(int sampleRate, quint32 seed)
+    : m_sampleRate(sampleRate)
+    , m_seed(seed)
+{
+}
+
+QByteArray SignalGenerator::generate(Signal signal, qreal frequency, qreal duration) const
+{
+    const int length = duration * m_sampleRate;
+    QVector<qreal> samples(length, 0);
+    quint32 state = m_seed;
+    for (int i = 0; i < length; ++i) {
+        const qreal t = qreal(i) / m_sampleRate;
+        qreal &s = samples[i];
+        switch (signal) {
+        case Sine:
+            s = std::sin(2 * M_PI * frequency * t);
+            break;
+        case PluckedString:
+            // Plucking at a fifth of the length suppresses every fifth
+            // harmonic; higher harmonics decay faster
+            for (int n = 1; n <= 12 && n * frequency < 0.5 * m_sampleRate; ++n)
+                s += std::abs(std::sin(n * M_PI / 5)) / (n * n) * std::exp(-1.5 * n * t) * std::sin(2 * M_PI * n * frequency * t);
+            break;
+        case Piano:
+            for (int n = 1; n <= 10; ++n) {
+                const qreal f = n * frequency * std::sqrt(1 + Inharmonicity * n * n);
+                if (f < 0.5 * m_sampleRate)
+                    s += std::exp(-t * n / 1.5) / n * std::sin(2 * M_PI * f * t);
+            }
+            break;
+        case NoisyHum:
+            for (int n = 1; n <= 3; ++n)
+                s += std::sin(2 * M_PI * n * frequency * t) / n;
+            s += 0.3 * std::sin(2 * M_PI * 50 * t) + 0.1 * std::sin(2 * M_PI * 150 * t);
+            s += 0.1 * gaussianNoise(state);
+            break;
+        }
+    }
+
+    const qreal peak = std::max(qreal(1e-12), std::abs(*std::max_element(samples.constBegin(), samples.constEnd(), [](qreal a, qreal b) {
+        return std::abs(a) < std::abs(b);
+    })));
+    QByteArray data(length * sizeof(qint16), 0);
+    auto out = reinterpret_cast<qint16*>(data.data());
+    for (const auto s : samples)
+        *out++ = qint16(qRound(0.5 * 32767 * s / peak));
+    return data;
+}
+
+qreal SignalGenerator::expectedFrequency(Signal signal, qreal frequency)
+{
+    // The stretched first partial is what a tuner hears as the pitch
+    return signal == Piano ? frequency * std::sqrt(1 + Inharmonicity) : frequency;
+}
+
+QString SignalGenerator::name(Signal signal)
+{
+    switch (signal) {
+    case Sine:
+        return QStringLiteral("sine");
+    case PluckedString:
+        return QStringLiteral("plucked");
+    case Piano:
+        return QStringLiteral("piano");
+    case NoisyHum:
+        return QStringLiteral("noisy-hum");
+    }
+    return QString();
+}
+
+QVector<SignalGenerator::Signal> SignalGenerator::signalTypes()
+{
+    return {Sine, PluckedString, Piano, NoisyHum};
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIGNALGENERATOR_H
+#define SIGNALGENERATOR_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+/* Generator of deterministic test signals with a known pitch.
+ *
+ * All signals are returned as 16 bit signed samples, peaking at half the full
+ * scale. The same arguments always produce the same samples, including the
+ * noise, so measurements can be compared between runs and machines.
+ */
+class SignalGenerator
+{
+public:
+    enum Signal {
+        Sine,           // Pure sine wave
+        PluckedString,  // Decaying harmonics, as of a string plucked near the bridge
+        Piano,          // Stretched, inharmonic partials of a stiff string
+        NoisyHum        // Harmonic tone with white noise and 50 Hz mains hum
+    };
+
+    explicit SignalGenerator(int sampleRate, quint32 seed = 1);
+
+    QByteArray generate(Signal signal, qreal frequency, qreal duration) const;
+    // The pitch a tuner should report for the given signal and frequency
+    static qreal expectedFrequency(Signal signal, qreal frequency);
+    static QString name(Signal signal);
+    static QVector<Signal> signalTypes();
+
+private:
+    // Stretch of the partials of the piano model
+    static const qreal Inharmonicity;
+
+    const int m_sampleRate;
+    const quint32 m_seed;
+};
+
+#endif // SIGNALGENERATOR_H
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "biquadcascade.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace {
+    // Samples filtered by one section before moving on to the next
+    const int BlockSize = 256;
+}
+
+BiquadCascade::BiquadCascade()
+{
+}
+
+BiquadCascade::BiquadCascade(const QVector<Section> &sections)
+    : m_sections(sections)
+    , m_state(2 * sections.size(), 0)
+{
+}
+
+void BiquadCascade::reset(qreal input)
+{
+    // With constant input x and output y = H(1) x, the state equations below
+    // give s2 = b2 x - a2 y and s1 = b1 x - a1 y + s2. The output of each
+    // section is the input of the next.
+    qreal x = input;
+    for (int i = 0; i < size(); ++i) {
+        const auto &c = m_sections.at(i);
+        const qreal y = x * (c.b0 + c.b1 + c.b2) / (1 + c.a1 + c.a2);
+        m_state[2 * i + 1] = c.b2 * x - c.a2 * y;
+        m_state[2 * i] = c.b1 * x - c.a1 * y + m_state[2 * i + 1];
+        x = y;
+    }
+}
+
+void BiquadCascade::process(qreal *samples, int count)
+{
+    for (int start = 0; start < count; start += BlockSize) {
+        qreal *x = samples + start;
+        const int n = std::min(BlockSize, count - start);
+        for (int i = 0; i < size(); ++i) {
+            const auto c = m_sections.at(i);
+            qreal s1 = m_state.at(2 * i);
+            qreal s2 = m_state.at(2 * i + 1);
+            for (int j = 0; j < n; ++j) {
+                const qreal in = x[j];
+                const qreal out = c.b0 * in + s1;
+                s1 = c.b1 * in - c.a1 * out + s2;
+                s2 = c.b2 * in - c.a2 * out;
+                x[j] = out;
+            }
+            m_state[2 * i] = s1;
+            m_state[2 * i + 1] = s2;
+        }
+    }
+}
+
+std::complex<qreal> BiquadCascade::response(qreal frequency) const
+{
+    const auto z1 = std::polar(1.0, -2 * M_PI * frequency);
+    const auto z2 = z1 * z1;
+    std::complex<qreal> h = 1;
+    for (const auto &c : m_sections)
+        h *= (c.b0 + c.b1 * z1 + c.b2 * z2) / (1.0 + c.a1 * z1 + c.a2 * z2);
+    return h;
+}
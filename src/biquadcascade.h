@@ -0,0 +1,68 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BIQUADCASCADE_H
+#define BIQUADCASCADE_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#include <complex>
+
+/* Digital IIR filter made of second-order sections in series, applied to a
+ * stream of samples.
+ *
+ * Each section runs in transposed direct form II and keeps two state values,
+ * which carry over between calls to process(). The recursion of a section
+ * cannot be vectorised over time, so the samples are filtered in blocks, one
+ * section at a time, which keeps the coefficients and state of the running
+ * section in registers.
+ */
+class BiquadCascade
+{
+public:
+    // H(z) = (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2)
+    struct Section
+    {
+        qreal b0 = 1;
+        qreal b1 = 0;
+        qreal b2 = 0;
+        qreal a1 = 0;
+        qreal a2 = 0;
+    };
+
+    BiquadCascade();
+    explicit BiquadCascade(const QVector<Section> &sections);
+
+    int size() const { return m_sections.size(); }
+    const QVector<Section> &sections() const { return m_sections; }
+    // Set the state to that reached after a constant input, so that a stream
+    // starting at that value enters the filter without a step
+    void reset(qreal input = 0);
+    // Filter count samples in place, continuing from the current state
+    void process(qreal *samples, int count);
+    // Frequency response at the given frequency, in cycles per sample
+    std::complex<qreal> response(qreal frequency) const;
+
+private:
+    QVector<Section> m_sections;
+    QVector<qreal> m_state;     // Two values per section
+};
+
+#endif // BIQUADCASCADE_H
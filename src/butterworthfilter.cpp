@@ -19,24 +19,51 @@
 
 #include "butterworthfilter.h"
 
+#include <algorithm>
 #include <functional>
 
 namespace {
     // Imaginary constant
     const auto I = std::complex<qreal>(0, 1);
+    // Cutoffs closer to the Nyquist frequency than this, in radians per
+    // sample, are taken to lie beyond it
+    const qreal MaxDigitalCutoff = 0.95 * M_PI;
+
+    // Pair the values so that complex conjugates share a pair, followed by
+    // the real values in order of magnitude
+    QVector<std::complex<qreal>> pairConjugates(QVector<std::complex<qreal>> v)
+    {
+        const qreal eps = 1e-9;
+        QVector<std::complex<qreal>> pairs;
+        QVector<std::complex<qreal>> reals;
+        pairs.reserve(v.size());
+        std::sort(v.begin(), v.end(), [](std::complex<qreal> a, std::complex<qreal> b) { return a.imag() > b.imag(); });
+        for (const auto x : v) {
+            if (x.imag() > eps)
+                pairs << x << std::conj(x);
+            else if (std::abs(x.imag()) <= eps)
+                reals << x.real();
+        }
+        std::sort(reals.begin(), reals.end(), [](std::complex<qreal> a, std::complex<qreal> b) { return a.real() < b.real(); });
+        return pairs << reals;
+    }
+
+    // Bins evaluated together by ButterworthFilter::response()
+    const int ResponseBlockSize = 64;
 
     // Product of vector elements
-    template<typename T> inline T prod(const QVector<T> v)
+    template<typename T> inline T prod(const QVector<T> &v)
     {
         return std::accumulate(v.constBegin(), v.constEnd(), T(1.0), std::multiplies<T>());
     }
 
     // Product of vector elements, pre-transformed by an operator
-    template<typename T, class UnaryOperator> inline T prod(const QVector<T> v, UnaryOperator op)
+    template<typename T, class UnaryOperator> inline T prod(const QVector<T> &v, UnaryOperator op)
     {
-        QVector<T> w(v.size());
-        std::transform(v.begin(), v.end(), w.begin(), op);
-        return prod(w);
+        T result(1.0);
+        for (const auto &x : v)
+            result *= op(x);
+        return result;
     }
 
     // Transform a vector in place by applying an operator to each element
@@ -83,6 +110,43 @@ ButterworthFilter::creal ButterworthFilter::operator()(qreal f) const
     return operator()(2 * M_PI * I * f / m_sampleRate);
 }
 
+void ButterworthFilter::response(qreal spacing, int count, creal *output) const
+{
+    // The products over the zeros and poles are accumulated for a block of
+    // bins at a time, one factor s - z at a time, in separate real and
+    // imaginary arrays so that the loops over the bins vectorise. On the
+    // imaginary axis, the factor is -Re(z) + i (w - Im(z)).
+    const qreal dw = 2 * M_PI * spacing / m_sampleRate;
+    qreal numRe[ResponseBlockSize], numIm[ResponseBlockSize];
+    qreal denRe[ResponseBlockSize], denIm[ResponseBlockSize];
+    for (int start = 0; start < count; start += ResponseBlockSize) {
+        const int n = std::min(ResponseBlockSize, count - start);
+        const auto multiply = [&](const CVector &factors, qreal *re, qreal *im) {
+            for (const auto z : factors) {
+                const qreal fr = -z.real();
+                const qreal w0 = start * dw - z.imag();
+                for (int k = 0; k < n; ++k) {
+                    const qreal fi = w0 + k * dw;
+                    const qreal r = re[k] * fr - im[k] * fi;
+                    im[k] = re[k] * fi + im[k] * fr;
+                    re[k] = r;
+                }
+            }
+        };
+        std::fill(numRe, numRe + n, m_gain);
+        std::fill(numIm, numIm + n, 0.0);
+        std::fill(denRe, denRe + n, 1.0);
+        std::fill(denIm, denIm + n, 0.0);
+        multiply(m_zeros, numRe, numIm);
+        multiply(m_poles, denRe, denIm);
+        for (int k = 0; k < n; ++k) {
+            const qreal norm = denRe[k] * denRe[k] + denIm[k] * denIm[k];
+            output[start + k] = creal((numRe[k] * denRe[k] + numIm[k] * denIm[k]) / norm,
+                                      (numIm[k] * denRe[k] - numRe[k] * denIm[k]) / norm);
+        }
+    }
+}
+
 ButterworthFilter::CVector ButterworthFilter::operator()(const QVector<qreal> freq) const
 {
     CVector response(freq.size());
@@ -90,13 +154,78 @@ ButterworthFilter::CVector ButterworthFilter::operator()(const QVector<qreal> fr
     return response;
 }
 
-ButterworthFilter::CVector ButterworthFilter::operator()(const Spectrum spectrum) const
+ButterworthFilter::CVector ButterworthFilter::operator()(const Spectrum &spectrum) const
 {
     CVector response(spectrum.size());
-    std::transform(spectrum.cbegin(), spectrum.cend(), response.begin(), [&](Tone s){ return operator()(s.frequency); });
+    for (int i = 0; i < spectrum.size(); ++i)
+        response[i] = operator()(spectrum.frequency(i));
     return response;
 }
 
+BiquadCascade ButterworthFilter::digitalFilter() const
+{
+    // Prewarp the cutoffs so that the bilinear transform, s = 2 (z - 1) /
+    // (z + 1), maps them back to the original frequencies
+    const auto prewarp = [](qreal w) { return 2 * std::tan(0.5 * w); };
+    FilterType type = m_type;
+    qreal low = m_cutoff.first();
+    qreal high = m_cutoff.last();
+    if ((type == BandPass || type == BandStop) && high >= MaxDigitalCutoff)
+        type = type == BandPass ? HighPass : LowPass;
+    if (low >= MaxDigitalCutoff) {
+        // The whole band lies below the cutoff, which a lowpass filter passes
+        // and the others block
+        BiquadCascade::Section s;
+        s.b0 = type == LowPass ? 1 : 0;
+        return BiquadCascade({s});
+    }
+    low = prewarp(low);
+    // The second cutoff of a lowpass or highpass filter is virtual
+    high = type == LowPass || type == HighPass ? 2 * low : prewarp(high);
+    const ButterworthFilter analog(low, high, m_order, 2 * M_PI, type);
+
+    // Map the poles and zeros. Zeros at infinity map to z = -1.
+    creal gain = analog.m_gain;
+    CVector poles;
+    CVector zeros;
+    for (const auto p : analog.m_poles) {
+        poles << (2.0 + p) / (2.0 - p);
+        gain /= 2.0 - p;
+    }
+    for (const auto z : analog.m_zeros) {
+        zeros << (2.0 + z) / (2.0 - z);
+        gain *= 2.0 - z;
+    }
+    while (zeros.size() < poles.size())
+        zeros << -1;
+    poles = pairConjugates(poles);
+    zeros = pairConjugates(zeros);
+
+    // One section per pair, with the gain in the first one
+    QVector<BiquadCascade::Section> sections;
+    for (int i = 0; i < poles.size(); i += 2) {
+        BiquadCascade::Section s;
+        if (i + 1 < poles.size()) {
+            s.a1 = -std::real(poles.at(i) + poles.at(i + 1));
+            s.a2 = std::real(poles.at(i) * poles.at(i + 1));
+            s.b1 = -std::real(zeros.at(i) + zeros.at(i + 1));
+            s.b2 = std::real(zeros.at(i) * zeros.at(i + 1));
+        } else {
+            s.a1 = -std::real(poles.at(i));
+            s.b1 = -std::real(zeros.at(i));
+        }
+        sections << s;
+    }
+    if (!sections.isEmpty()) {
+        auto &first = sections.first();
+        const qreal g = std::real(gain);
+        first.b0 *= g;
+        first.b1 *= g;
+        first.b2 *= g;
+    }
+    return BiquadCascade(sections);
+}
+
 void ButterworthFilter::operator+=(const ButterworthFilter& other)
 {
     // Only these properties matter for evaluation
@@ -20,6 +20,7 @@
 #ifndef BUTTERWORTHFILTER_H
 #define BUTTERWORTHFILTER_H
 
+#include "biquadcascade.h"
 #include "spectrum.h"
 
 #include <QtGlobal>
@@ -45,9 +46,18 @@ public:
     creal operator()(creal s) const;
     // Evaluate at s = 2*pi * i * f
     creal operator()(qreal f) const;
+    // Write the response at the frequencies 0, spacing, ... (count - 1) *
+    // spacing to output, without allocating
+    void response(qreal spacing, int count, creal *output) const;
     // Return the frequency response for a given vector of frequencies
     CVector operator()(const QVector<qreal> freq) const;
-    CVector operator()(const Spectrum spectrum) const;
+    CVector operator()(const Spectrum &spectrum) const;
+    // Digital filter with the same cutoffs, obtained by the bilinear
+    // transform of a design with prewarped cutoffs. A band filter whose
+    // upper cutoff lies beyond the Nyquist frequency becomes a highpass
+    // (bandpass) or lowpass (bandstop) filter. Filters combined by addition
+    // are not supported.
+    BiquadCascade digitalFilter() const;
     // Add another filter to this one
     void operator+=(const ButterworthFilter &other);
     friend ButterworthFilter operator+(ButterworthFilter f1, const ButterworthFilter f2);
@@ -63,6 +63,9 @@ KTunerConfigDialog::KTunerConfigDialog(QWidget *parent)
     for (int i = std::pow(2, 8); i < std::pow(2, 16); i *= 2)
         m_analysisSettings->segmentLength->addItem(QString::number(i));
     m_analysisSettings->kcfg_WindowFunction->addItems(QStringList {"Rectangular Window", "Hann Window", "Gaussian Window"});
+    m_analysisSettings->kcfg_Precision->addItems(QStringList {"Double precision", "Single precision"});
+    m_analysisSettings->kcfg_Averaging->addItems(QStringList {"Moving average", "Exponential average"});
+    m_analysisSettings->kcfg_QueuePolicy->addItems(QStringList {"Drop oldest segment", "Drop newest segment"});
 
     page = new QWidget;
     m_tuningSettings->setupUi(page);
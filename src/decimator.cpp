@@ -0,0 +1,116 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decimator.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace {
+    // Filter taps per unit of the factor, so that the filter spans this many
+    // output samples. The transition band of the Blackman window is about
+    // 5.5 / taps wide, 0.17 times the output sample rate, so the passband
+    // extends to 0.41 times the output sample rate.
+    const int TapsPerFactor = 32;
+    // Output sample rate per Hz of the highest frequency that is kept. Above
+    // 0.4 times the output rate, aliases only land in the transition band.
+    const qreal Oversampling = 2.5;
+    const int MaxFactor = 16;
+    // Input samples copied into the buffer at a time
+    const int BlockSize = 1024;
+}
+
+Decimator::Decimator()
+    : m_factor(1)
+    , m_phase(0)
+    , m_primed(false)
+{
+    setFactor(1);
+}
+
+int Decimator::factorFor(qreal sampleRate, qreal highestFrequency)
+{
+    int factor = 1;
+    if (highestFrequency <= 0)
+        return factor;
+    while (factor < MaxFactor && sampleRate / (2 * factor) >= Oversampling * highestFrequency)
+        factor *= 2;
+    return factor;
+}
+
+void Decimator::setFactor(int factor)
+{
+    m_factor = std::max(1, factor);
+    const int taps = TapsPerFactor * m_factor;
+    m_taps.resize(taps);
+    // Cut off at half the output sample rate, in cycles per input sample
+    const qreal cutoff = 0.5 / m_factor;
+    const qreal centre = 0.5 * (taps - 1);
+    qreal sum = 0;
+    for (int k = 0; k < taps; ++k) {
+        const qreal t = k - centre;
+        const qreal sinc = t == 0 ? 2 * cutoff : std::sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        const qreal x = 2 * M_PI * k / (taps - 1);
+        const qreal window = 0.42 - 0.5 * std::cos(x) + 0.08 * std::cos(2 * x);
+        m_taps[k] = sinc * window;
+        sum += m_taps[k];
+    }
+    // Unit gain at zero frequency
+    for (auto &tap : m_taps)
+        tap /= sum;
+    m_buffer.fill(0, taps - 1 + BlockSize);
+    reset();
+}
+
+void Decimator::reset()
+{
+    m_phase = 0;
+    m_primed = false;
+}
+
+int Decimator::process(const qreal *input, int count, qreal *output)
+{
+    if (count <= 0)
+        return 0;
+    const int taps = m_taps.size();
+    qreal *buffer = m_buffer.data();
+    if (!m_primed) {
+        std::fill(buffer, buffer + taps - 1, input[0]);
+        m_primed = true;
+    }
+
+    // The output completing the current phase uses the taps samples ending
+    // at that input sample; the taps are symmetric
+    const qreal *h = m_taps.constData();
+    int produced = 0;
+    for (int start = 0; start < count; start += BlockSize) {
+        const int n = std::min(BlockSize, count - start);
+        std::copy(input + start, input + start + n, buffer + taps - 1);
+        for (int j = m_factor - 1 - m_phase; j < n; j += m_factor) {
+            const qreal *x = buffer + j;
+            qreal y = 0;
+            for (int k = 0; k < taps; ++k)
+                y += h[k] * x[k];
+            output[produced++] = y;
+        }
+        m_phase = (m_phase + n) % m_factor;
+        std::copy(buffer + n, buffer + n + taps - 1, buffer);
+    }
+    return produced;
+}
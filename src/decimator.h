@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <QtGlobal>
+#include <QVector>
+
+/* Lowpass filter and downsampler of a stream by an integer factor.
+ *
+ * The anti-aliasing filter is a Blackman windowed sinc, cut off at the output
+ * Nyquist frequency, whose length is a fixed number of taps times the factor.
+ * It is a direct FIR filter evaluated only at the kept outputs, every
+ * factor-th input sample. Each output therefore costs that length in
+ * multiply-adds, which amounts to a fixed number of multiply-adds per input
+ * sample whatever the factor.
+ */
+class Decimator
+{
+public:
+    Decimator();
+
+    // The largest factor, a power of two, that keeps frequencies up to the
+    // given one well inside the passband
+    static int factorFor(qreal sampleRate, qreal highestFrequency);
+
+    // Design the filter for the given factor and start a new stream
+    void setFactor(int factor);
+    int factor() const { return m_factor; }
+    // Start a new stream. Its first sample is taken to extend into the past,
+    // so that no step enters the filter.
+    void reset();
+    // Number of outputs that the next count input samples produce
+    int outputCount(int count) const { return (m_phase + count) / m_factor; }
+    // Filter count input samples and write the outputs to output, returning
+    // their number
+    int process(const qreal *input, int count, qreal *output);
+
+private:
+    int m_factor;
+    QVector<qreal> m_taps;
+    QVector<qreal> m_buffer;    // The last taps - 1 input samples, followed by room for a block
+    int m_phase;                // Input samples since the last output
+    bool m_primed;              // Whether the buffer holds input
+};
+
+#endif // DECIMATOR_H
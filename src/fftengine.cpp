@@ -0,0 +1,338 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fftengine.h"
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <QThreadPool>
+#include <QWeakPointer>
+
+#include <algorithm>
+#include <atomic>
+
+#include <fftw3.h>
+
+namespace {
+    // The FFTW planner is not thread-safe, unlike execution of the plans
+    QMutex plannerMutex;
+
+    bool planInBackground = true;
+    bool wisdomPathSet = false;
+    QString wisdomPath;
+
+    // Map the FFTW interface to the precision of the engine. FFTW and C++
+    // complex types are binary compatible.
+    template<typename T> struct Fftw;
+
+    template<> struct Fftw<double>
+    {
+        using Plan = fftw_plan;
+        static const char *name() { return "double"; }
+        static void *malloc(size_t n) { return fftw_malloc(n); }
+        static void free(void *p) { fftw_free(p); }
+        static Plan forward(int n, double *in, std::complex<double> *out, unsigned flags)
+        {
+            return fftw_plan_dft_r2c_1d(n, in, reinterpret_cast<fftw_complex*>(out), flags);
+        }
+        static Plan inverse(int n, std::complex<double> *in, double *out, unsigned flags)
+        {
+            return fftw_plan_dft_c2r_1d(n, reinterpret_cast<fftw_complex*>(in), out, flags);
+        }
+        static void forward(Plan plan, double *in, std::complex<double> *out)
+        {
+            fftw_execute_dft_r2c(plan, in, reinterpret_cast<fftw_complex*>(out));
+        }
+        static void inverse(Plan plan, std::complex<double> *in, double *out)
+        {
+            fftw_execute_dft_c2r(plan, reinterpret_cast<fftw_complex*>(in), out);
+        }
+        static void destroy(Plan plan) { fftw_destroy_plan(plan); }
+        static char *exportWisdom() { return fftw_export_wisdom_to_string(); }
+        static bool importWisdom(const char *wisdom) { return fftw_import_wisdom_from_string(wisdom); }
+    };
+
+    template<> struct Fftw<float>
+    {
+        using Plan = fftwf_plan;
+        static const char *name() { return "float"; }
+        static void *malloc(size_t n) { return fftwf_malloc(n); }
+        static void free(void *p) { fftwf_free(p); }
+        static Plan forward(int n, float *in, std::complex<float> *out, unsigned flags)
+        {
+            return fftwf_plan_dft_r2c_1d(n, in, reinterpret_cast<fftwf_complex*>(out), flags);
+        }
+        static Plan inverse(int n, std::complex<float> *in, float *out, unsigned flags)
+        {
+            return fftwf_plan_dft_c2r_1d(n, reinterpret_cast<fftwf_complex*>(in), out, flags);
+        }
+        static void forward(Plan plan, float *in, std::complex<float> *out)
+        {
+            fftwf_execute_dft_r2c(plan, in, reinterpret_cast<fftwf_complex*>(out));
+        }
+        static void inverse(Plan plan, std::complex<float> *in, float *out)
+        {
+            fftwf_execute_dft_c2r(plan, reinterpret_cast<fftwf_complex*>(in), out);
+        }
+        static void destroy(Plan plan) { fftwf_destroy_plan(plan); }
+        static char *exportWisdom() { return fftwf_export_wisdom_to_string(); }
+        static bool importWisdom(const char *wisdom) { return fftwf_import_wisdom_from_string(wisdom); }
+    };
+
+    // Wisdom is only valid on the machine it was measured on, so name the
+    // file after the CPU model
+    QString cpuKey()
+    {
+        QByteArray model;
+        QFile cpuInfo(QStringLiteral("/proc/cpuinfo"));
+        if (cpuInfo.open(QIODevice::ReadOnly)) {
+            for (const auto &line : cpuInfo.readAll().split('\n')) {
+                if (line.startsWith("model name")) {
+                    model = line.mid(line.indexOf(':') + 1).trimmed();
+                    break;
+                }
+            }
+        }
+        return QSysInfo::currentCpuArchitecture() + QLatin1Char('-') + QString::number(qHash(model), 16);
+    }
+
+    template<typename T> QString wisdomFile()
+    {
+        const auto directory = FftPlanner::wisdomDirectory();
+        if (directory.isEmpty())
+            return QString();
+        static const QString key = cpuKey();
+        return directory + QStringLiteral("/fftw-wisdom-%1-%2").arg(key, QLatin1String(Fftw<T>::name()));
+    }
+
+    // Import the stored wisdom on first use, with the planner locked
+    template<typename T> void loadWisdom(const QString &fileName)
+    {
+        static bool loaded = false;
+        if (loaded)
+            return;
+        loaded = true;
+        QFile file(fileName);
+        if (!fileName.isEmpty() && file.open(QIODevice::ReadOnly))
+            Fftw<T>::importWisdom(file.readAll().constData());
+    }
+
+    template<typename T> void saveWisdom()
+    {
+        const auto fileName = wisdomFile<T>();
+        if (fileName.isEmpty())
+            return;
+        QMutexLocker lock(&plannerMutex);
+        char *wisdom = Fftw<T>::exportWisdom();
+        const QByteArray data(wisdom);
+        free(wisdom);
+        lock.unlock();
+
+        QDir().mkpath(QFileInfo(fileName).path());
+        QSaveFile file(fileName);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(data);
+            file.commit();
+        }
+    }
+
+    // Plan both directions with the given flags on scratch buffers, since
+    // measuring overwrites them. The plans are executed with the engine's own
+    // buffers, which FFTW allocated with the same alignment.
+    template<typename T> bool makePlans(int size, unsigned flags, typename Fftw<T>::Plan &forward, typename Fftw<T>::Plan &inverse)
+    {
+        T *in = static_cast<T*>(Fftw<T>::malloc(size * sizeof(T)));
+        auto out = static_cast<std::complex<T>*>(Fftw<T>::malloc((size / 2 + 1) * sizeof(std::complex<T>)));
+        const auto fileName = wisdomFile<T>();
+        QMutexLocker lock(&plannerMutex);
+        loadWisdom<T>(fileName);
+        forward = Fftw<T>::forward(size, in, out, flags);
+        inverse = Fftw<T>::inverse(size, out, in, flags);
+        if (!forward || !inverse) {
+            if (forward)
+                Fftw<T>::destroy(forward);
+            if (inverse)
+                Fftw<T>::destroy(inverse);
+            forward = nullptr;
+            inverse = nullptr;
+        }
+        lock.unlock();
+        Fftw<T>::free(in);
+        Fftw<T>::free(out);
+        return forward;
+    }
+
+    template<typename T> void destroyPlans(typename Fftw<T>::Plan forward, typename Fftw<T>::Plan inverse)
+    {
+        QMutexLocker lock(&plannerMutex);
+        Fftw<T>::destroy(forward);
+        Fftw<T>::destroy(inverse);
+    }
+}
+
+// Measured plans handed from the background planner to an engine
+template<typename T>
+struct FftPlanUpgrade
+{
+    using Plan = typename FftwDetail::Plan<T>::Type;
+
+    ~FftPlanUpgrade()
+    {
+        if (ready.load(std::memory_order_acquire))
+            destroyPlans<T>(forward, inverse);
+    }
+
+    Plan forward = nullptr;
+    Plan inverse = nullptr;
+    std::atomic<bool> ready {false};
+};
+
+namespace {
+    template<typename T>
+    class PlanUpgradeJob : public QRunnable
+    {
+    public:
+        PlanUpgradeJob(int size, const QSharedPointer<FftPlanUpgrade<T>> &upgrade)
+            : m_size(size)
+            , m_upgrade(upgrade)
+        {
+        }
+
+        void run() override
+        {
+            // Nothing to do if the engine was destroyed in the meantime
+            if (!m_upgrade.toStrongRef())
+                return;
+            typename Fftw<T>::Plan forward, inverse;
+            if (!makePlans<T>(m_size, FFTW_MEASURE, forward, inverse))
+                return;
+            saveWisdom<T>();
+            if (const auto upgrade = m_upgrade.toStrongRef()) {
+                upgrade->forward = forward;
+                upgrade->inverse = inverse;
+                upgrade->ready.store(true, std::memory_order_release);
+            } else {
+                destroyPlans<T>(forward, inverse);
+            }
+        }
+
+    private:
+        const int m_size;
+        const QWeakPointer<FftPlanUpgrade<T>> m_upgrade;
+    };
+}
+
+void FftPlanner::setBackgroundPlanning(bool enable)
+{
+    QMutexLocker lock(&plannerMutex);
+    planInBackground = enable;
+}
+
+bool FftPlanner::backgroundPlanning()
+{
+    QMutexLocker lock(&plannerMutex);
+    return planInBackground;
+}
+
+void FftPlanner::setWisdomDirectory(const QString &path)
+{
+    QMutexLocker lock(&plannerMutex);
+    wisdomPath = path;
+    wisdomPathSet = true;
+}
+
+QString FftPlanner::wisdomDirectory()
+{
+    QMutexLocker lock(&plannerMutex);
+    // Shared by the application and the command line tools
+    if (!wisdomPathSet) {
+        wisdomPath = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QStringLiteral("/ktuner");
+        wisdomPathSet = true;
+    }
+    return wisdomPath;
+}
+
+template<typename T>
+FftEngine<T>::FftEngine(int size)
+    : m_size(size)
+    , m_input(static_cast<T*>(Fftw<T>::malloc(size * sizeof(T))))
+    , m_output(static_cast<Complex*>(Fftw<T>::malloc(outputSize() * sizeof(Complex))))
+    , m_forward(nullptr)
+    , m_inverse(nullptr)
+{
+    // Use stored wisdom if there is any. Otherwise either measure now or
+    // start with an estimate and measure in the background.
+    if (!makePlans<T>(m_size, FFTW_MEASURE | FFTW_WISDOM_ONLY, m_forward, m_inverse)) {
+        if (FftPlanner::backgroundPlanning()) {
+            makePlans<T>(m_size, FFTW_ESTIMATE, m_forward, m_inverse);
+            m_upgrade.reset(new FftPlanUpgrade<T>);
+            QThreadPool::globalInstance()->start(new PlanUpgradeJob<T>(m_size, m_upgrade));
+        } else {
+            makePlans<T>(m_size, FFTW_MEASURE, m_forward, m_inverse);
+            saveWisdom<T>();
+        }
+    }
+    std::fill(m_input, m_input + m_size, T(0));
+    std::fill(m_output, m_output + outputSize(), Complex(0));
+}
+
+template<typename T>
+FftEngine<T>::~FftEngine()
+{
+    destroyPlans<T>(m_forward, m_inverse);
+    Fftw<T>::free(m_input);
+    Fftw<T>::free(m_output);
+}
+
+template<typename T>
+void FftEngine<T>::adoptUpgrade()
+{
+    if (!m_upgrade->ready.load(std::memory_order_acquire))
+        return;
+    // Swap the plans, so that the estimated ones are destroyed along with the
+    // upgrade
+    std::swap(m_forward, m_upgrade->forward);
+    std::swap(m_inverse, m_upgrade->inverse);
+    m_upgrade.reset();
+}
+
+template<typename T>
+void FftEngine<T>::forward()
+{
+    if (m_upgrade)
+        adoptUpgrade();
+    Fftw<T>::forward(m_forward, m_input, m_output);
+}
+
+template<typename T>
+void FftEngine<T>::inverse()
+{
+    Fftw<T>::inverse(m_inverse, m_output, m_input);
+}
+
+template class FftEngine<double>;
+template class FftEngine<float>;
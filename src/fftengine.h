@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFTENGINE_H
+#define FFTENGINE_H
+
+#include <QtGlobal>
+#include <QSharedPointer>
+#include <QString>
+
+#include <complex>
+
+struct fftw_plan_s;
+struct fftwf_plan_s;
+template<typename T> struct FftPlanUpgrade;
+
+namespace FftwDetail {
+    template<typename T> struct Plan;
+    template<> struct Plan<double> { using Type = fftw_plan_s*; };
+    template<> struct Plan<float> { using Type = fftwf_plan_s*; };
+}
+
+/* Process wide options of the FFTW planner.
+ *
+ * Measuring the fastest plan for a large transform takes up to seconds. By
+ * default, new engines therefore start with an estimated plan and measure the
+ * optimal one on a background thread, which the engine switches to when it is
+ * ready. The results are stored as FFTW wisdom in KTuner's data directory,
+ * in a file per CPU model and precision, so that later runs start with the
+ * optimal plan immediately.
+ */
+class FftPlanner
+{
+public:
+    // Measure plans while constructing engines instead, so that the results
+    // of all transforms of a given size are identical
+    static void setBackgroundPlanning(bool enable);
+    static bool backgroundPlanning();
+    // Directory of the wisdom files, or an empty string to disable them
+    static void setWisdomDirectory(const QString &path);
+    static QString wisdomDirectory();
+};
+
+/* Real-to-complex discrete Fourier transform of a fixed size and its inverse,
+ * in double (fftw) or single precision (fftwf).
+ *
+ * The input and output buffers are allocated by FFTW, so they are aligned for
+ * its SIMD code and for vectorised loops over the data. The transforms work in
+ * place on these buffers: forward() transforms input() into output() and
+ * inverse() transforms output() back into input(), scaled by size().
+ */
+template<typename T>
+class FftEngine
+{
+public:
+    using Complex = std::complex<T>;
+
+    explicit FftEngine(int size);
+    ~FftEngine();
+
+    int size() const { return m_size; }
+    int outputSize() const { return m_size / 2 + 1; }
+    T *input() { return m_input; }
+    const T *input() const { return m_input; }
+    Complex *output() { return m_output; }
+    const Complex *output() const { return m_output; }
+    // Whether the engine still uses estimated plans
+    bool isUpgradePending() const { return !m_upgrade.isNull(); }
+
+    void forward();
+    void inverse();
+
+private:
+    Q_DISABLE_COPY(FftEngine)
+
+    using Plan = typename FftwDetail::Plan<T>::Type;
+
+    // Switch to measured plans if the background planner has finished
+    void adoptUpgrade();
+
+    const int m_size;
+    T *m_input;
+    Complex *m_output;
+    Plan m_forward;
+    Plan m_inverse;
+    QSharedPointer<FftPlanUpgrade<T>> m_upgrade;
+};
+
+#endif // FFTENGINE_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framequeue.h"
+
+#include <QMutexLocker>
+
+FrameQueue::FrameQueue(int capacity, Policy policy)
+    : m_frames(qMax(1, capacity))
+    , m_head(0)
+    , m_count(0)
+    , m_policy(policy)
+    , m_consumerIdle(true)
+    , m_interrupted(false)
+    , m_aborted(false)
+    , m_processed(0)
+    , m_dropped(0)
+{
+}
+
+void FrameQueue::setCapacity(int capacity)
+{
+    QMutexLocker lock(&m_mutex);
+    capacity = qMax(1, capacity);
+    if (capacity == m_frames.size())
+        return;
+    m_dropped += m_count;
+    m_frames = QVector<AudioFrame>(capacity);
+    m_head = 0;
+    m_count = 0;
+    m_notFull.wakeAll();
+}
+
+int FrameQueue::capacity() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_frames.size();
+}
+
+void FrameQueue::setPolicy(Policy policy)
+{
+    QMutexLocker lock(&m_mutex);
+    m_policy = policy;
+    m_notFull.wakeAll();
+}
+
+FrameQueue::Policy FrameQueue::policy() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_policy;
+}
+
+bool FrameQueue::push(const AudioFrame &frame)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_count == m_frames.size()) {
+        switch (m_policy) {
+        case DropOldest:
+            dropOldest();
+            break;
+        case DropNewest:
+            ++m_dropped;
+            return false;
+        case Block:
+            while (m_count == m_frames.size() && m_policy == Block && !m_aborted)
+                m_notFull.wait(&m_mutex);
+            if (m_aborted) {
+                ++m_dropped;
+                return false;
+            }
+            // The policy may have been changed while waiting
+            if (m_count == m_frames.size())
+                dropOldest();
+            break;
+        }
+    }
+    m_frames[(m_head + m_count) % m_frames.size()] = frame;
+    ++m_count;
+    m_notEmpty.wakeOne();
+
+    const bool wake = m_consumerIdle;
+    m_consumerIdle = false;
+    return wake;
+}
+
+bool FrameQueue::pop(AudioFrame &frame)
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_count == 0) {
+        m_consumerIdle = true;
+        return false;
+    }
+    take(frame);
+    return true;
+}
+
+bool FrameQueue::waitPop(AudioFrame &frame)
+{
+    QMutexLocker lock(&m_mutex);
+    while (m_count == 0 && !m_interrupted && !m_aborted)
+        m_notEmpty.wait(&m_mutex);
+    if (m_interrupted || m_aborted) {
+        m_interrupted = false;
+        m_consumerIdle = true;
+        return false;
+    }
+    take(frame);
+    return true;
+}
+
+void FrameQueue::interrupt()
+{
+    QMutexLocker lock(&m_mutex);
+    m_interrupted = true;
+    m_notEmpty.wakeAll();
+}
+
+void FrameQueue::clear()
+{
+    QMutexLocker lock(&m_mutex);
+    m_dropped += m_count;
+    m_head = 0;
+    m_count = 0;
+    m_notFull.wakeAll();
+}
+
+void FrameQueue::reportDropped()
+{
+    QMutexLocker lock(&m_mutex);
+    --m_processed;
+    ++m_dropped;
+}
+
+void FrameQueue::abort()
+{
+    QMutexLocker lock(&m_mutex);
+    m_aborted = true;
+    m_notFull.wakeAll();
+    m_notEmpty.wakeAll();
+}
+
+quint64 FrameQueue::processedCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_processed;
+}
+
+quint64 FrameQueue::droppedCount() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_dropped;
+}
+
+void FrameQueue::take(AudioFrame &frame)
+{
+    // Swap rather than copy, so the slot no longer holds on to the buffer
+    qSwap(frame, m_frames[m_head]);
+    m_head = (m_head + 1) % m_frames.size();
+    --m_count;
+    ++m_processed;
+    m_notFull.wakeOne();
+}
+
+void FrameQueue::dropOldest()
+{
+    m_frames[m_head] = AudioFrame();
+    m_head = (m_head + 1) % m_frames.size();
+    --m_count;
+    ++m_dropped;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEQUEUE_H
+#define FRAMEQUEUE_H
+
+#include "ringbuffer.h"
+
+#include <QtGlobal>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWaitCondition>
+
+/* Segment of the audio stream stored in a ring buffer. The frame keeps its
+ * buffer alive, so the audio input may switch to a new buffer at any time.
+ * Frames queued between full segments only ask for a fast pitch update.
+ */
+struct AudioFrame
+{
+    QSharedPointer<RingBuffer> buffer;
+    quint64 position = 0;
+    qint64 size = 0;
+    bool update = false;
+
+    AudioView view() const { return buffer->view(position, size); }
+    bool isIntact() const { return buffer->isIntact(position); }
+};
+
+/* Bounded queue of audio frames passed from the audio input to the analyzer
+ * thread. The frames only describe ranges in a ring buffer, so no sample data
+ * is copied.
+ *
+ * The queue is meant to be used by a single producer and a single consumer.
+ * When it is full, the policy decides whether the oldest queued frame is
+ * discarded, the new frame is discarded or the producer waits for the
+ * consumer to make room. The number of frames handed to the consumer and the
+ * number of discarded frames are counted, so that segment length and overlap
+ * can be matched to the processing capacity of the machine.
+ *
+ * A consumer may also wait for frames in waitPop(), so that it needs no
+ * notification per frame while it keeps up; interrupt() sends it back to its
+ * event loop.
+ */
+class FrameQueue
+{
+public:
+    // Block is only for producers that may wait, which the GUI thread may not
+    enum Policy {
+        DropOldest,
+        DropNewest,
+        Block
+    };
+
+    explicit FrameQueue(int capacity = 4, Policy policy = DropOldest);
+
+    // Resizing discards all queued frames
+    void setCapacity(int capacity);
+    int capacity() const;
+    void setPolicy(Policy policy);
+    Policy policy() const;
+
+    // Add a frame, applying the policy if the queue is full. Returns true if
+    // the consumer found the queue empty since its last successful pop and
+    // therefore needs to be notified.
+    bool push(const AudioFrame &frame);
+    // Take the oldest frame, returning false if the queue is empty
+    bool pop(AudioFrame &frame);
+    // Take the oldest frame, waiting for one if the queue is empty. Returns
+    // false if interrupted or aborted, after which the next push() notifies
+    // the consumer again.
+    bool waitPop(AudioFrame &frame);
+    // Make a consumer waiting in waitPop() return, or the next call of it if
+    // none is waiting, e.g. to let it handle a configuration change
+    void interrupt();
+    // Count a popped frame as dropped, because the audio input overwrote it
+    // before it could be read or the consumer could not analyse it
+    void reportDropped();
+    void clear();
+    // Release a producer blocked in push(), e.g. on shutdown
+    void abort();
+
+    quint64 processedCount() const;
+    quint64 droppedCount() const;
+
+private:
+    void dropOldest();
+    void take(AudioFrame &frame);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_notFull;
+    QWaitCondition m_notEmpty;
+    QVector<AudioFrame> m_frames;
+    int m_head;
+    int m_count;
+    Policy m_policy;
+    bool m_consumerIdle;
+    bool m_interrupted;
+    bool m_aborted;
+    quint64 m_processed;
+    quint64 m_dropped;
+};
+
+#endif // FRAMEQUEUE_H
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "goertzel.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace {
+    // Frequencies evaluated together in the inner loop, and per zoom level
+    const int Points = 8;
+    // Each level narrows the span to two steps of the previous one
+    const int Levels = 2;
+}
+
+template<typename T>
+void Goertzel::magnitudes(const T *signal, int size, qreal first, qreal step, int count, qreal *output)
+{
+    for (int p0 = 0; p0 < count; p0 += Points) {
+        // Goertzel's recurrence s(i) = x(i) + 2 cos(w) s(i-1) - s(i-2),
+        // iterated over a block of frequencies so that the inner loop
+        // vectorises. Unused lanes of the last block are computed and ignored.
+        qreal c[Points], s1[Points], s2[Points];
+        for (int p = 0; p < Points; ++p) {
+            c[p] = 2 * std::cos(first + (p0 + p) * step);
+            s1[p] = s2[p] = 0;
+        }
+        for (int i = 0; i < size; ++i) {
+            const qreal x = signal[i];
+            for (int p = 0; p < Points; ++p) {
+                const qreal s0 = x + c[p] * s1[p] - s2[p];
+                s2[p] = s1[p];
+                s1[p] = s0;
+            }
+        }
+        const int n = std::min(Points, count - p0);
+        for (int p = 0; p < n; ++p) {
+            const qreal power = s1[p] * s1[p] + s2[p] * s2[p] - c[p] * s1[p] * s2[p];
+            output[p0 + p] = std::sqrt(std::max<qreal>(0, power));
+        }
+    }
+}
+
+template<typename T>
+qreal Goertzel::refinePeak(const T *signal, int size, qreal frequency, qreal span)
+{
+    qreal m[Points];
+    for (int level = 0; level < Levels; ++level) {
+        const qreal step = span / (Points - 1);
+        const qreal first = frequency - 0.5 * span;
+        magnitudes(signal, size, first, step, Points, m);
+
+        // Interpolate around the largest inner point
+        const int peak = std::max_element(m + 1, m + Points - 1) - m;
+        const qreal num = m[peak-1] - m[peak+1];
+        const qreal denom = m[peak-1] - 2 * m[peak] + m[peak+1];
+        const qreal delta = denom < 0 ? qBound<qreal>(-0.5, 0.5 * num / denom, 0.5) : 0;
+        frequency = first + (peak + delta) * step;
+        span = 2 * step;
+    }
+    return frequency;
+}
+
+template void Goertzel::magnitudes(const float *, int, qreal, qreal, int, qreal *);
+template void Goertzel::magnitudes(const double *, int, qreal, qreal, int, qreal *);
+template qreal Goertzel::refinePeak(const float *, int, qreal, qreal);
+template qreal Goertzel::refinePeak(const double *, int, qreal, qreal);
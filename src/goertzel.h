@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GOERTZEL_H
+#define GOERTZEL_H
+
+#include <QtGlobal>
+
+/* Evaluation of the spectrum of a real signal at individual frequencies.
+ *
+ * Frequencies are given in radians per sample. The magnitudes are computed
+ * with Goertzel's recurrence for several frequencies at once, which costs a
+ * few operations per sample and frequency, O(N) per point, and needs no
+ * transform plans or buffers. This only pays off for a handful of
+ * frequencies, which is all that zooming in on a peak takes: evaluating a few
+ * points around it, moving to the best one and repeating on a finer grid
+ * resolves the peak far more finely than the bins of a full transform of the
+ * same signal.
+ */
+namespace Goertzel {
+    // Store the magnitudes of the transform of signal at count frequencies
+    // first, first + step, ... in output
+    template<typename T>
+    void magnitudes(const T *signal, int size, qreal first, qreal step, int count, qreal *output);
+    // Locate the maximum of the magnitude within half a span of frequency
+    template<typename T>
+    qreal refinePeak(const T *signal, int size, qreal frequency, qreal span);
+}
+
+#endif // GOERTZEL_H
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "humcanceller.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace {
+    const qreal NominalFrequencies[] = {50, 60};
+    // -3 dB width of each notch in Hz, which sets the adaptation step. The
+    // detectors are narrower, so that notes close to 50 or 60 Hz hardly
+    // register.
+    const qreal NotchWidth = 2;
+    const qreal DetectorWidth = 0.5;
+    // Samples between the checks of the mains frequency
+    const int BlockSize = 256;
+    // Power ratio between the detectors, and the time in seconds it must
+    // last, before switching to the other mains frequency
+    const qreal SwitchRatio = 4;
+    const qreal SwitchTime = 2;
+    // Hum power relative to the input power below which the weights are too
+    // noisy to detect or track the hum
+    const qreal MinimumHumShare = 0.01;
+    // Largest deviation from the nominal frequency in Hz that is tracked
+    const qreal MaximumDeviation = 1;
+    // Correction of the frequency per unit of weight rotation and step size,
+    // which damps the loop formed by the tracking and the lag of the weights
+    const qreal TrackingGain = 0.25;
+}
+
+void HumCanceller::Oscillator::setStep(qreal angle)
+{
+    stepC = std::cos(angle);
+    stepS = std::sin(angle);
+}
+
+void HumCanceller::Oscillator::advance()
+{
+    const qreal t = c * stepC - s * stepS;
+    s = s * stepC + c * stepS;
+    c = t;
+}
+
+void HumCanceller::Oscillator::normalise()
+{
+    const qreal r = 1 / std::sqrt(c * c + s * s);
+    c *= r;
+    s *= r;
+}
+
+HumCanceller::HumCanceller()
+    : m_mains(0)
+{
+    setSampleRate(48000);
+}
+
+void HumCanceller::setSampleRate(qreal sampleRate)
+{
+    m_sampleRate = sampleRate;
+    // The notch of an LMS canceller with unit references is about as wide in
+    // radians per sample as its step size
+    m_step = 2 * M_PI * NotchWidth / sampleRate;
+    m_detectorStep = 2 * M_PI * DetectorWidth / sampleRate;
+    m_votesNeeded = std::ceil(SwitchTime * sampleRate / BlockSize);
+    for (int i = 0; i < 2; ++i)
+        m_detectors[i].oscillator.setStep(2 * M_PI * NominalFrequencies[i] / sampleRate);
+    setMains(m_mains);
+    reset();
+}
+
+void HumCanceller::reset()
+{
+    m_reference.c = 1;
+    m_reference.s = 0;
+    m_weights.fill(0);
+    for (auto &d : m_detectors) {
+        d.oscillator.c = 1;
+        d.oscillator.s = 0;
+        d.a = d.b = 0;
+    }
+    m_lastA = m_lastB = 0;
+    m_tracking = false;
+    m_blockFill = 0;
+    m_blockPower = 0;
+    m_switchVotes = 0;
+}
+
+void HumCanceller::process(qreal *samples, int count)
+{
+    run(samples, samples, count);
+}
+
+void HumCanceller::prime(const qreal *samples, int count)
+{
+    const auto reference = m_reference;
+    const auto detectors = m_detectors;
+    const int blockFill = m_blockFill;
+    const qreal blockPower = m_blockPower;
+    run(samples, nullptr, count);
+    // Keep the weights and the tracked frequency, but start from the same
+    // phases again
+    m_reference.c = reference.c;
+    m_reference.s = reference.s;
+    for (int i = 0; i < 2; ++i)
+        m_detectors[i].oscillator = detectors[i].oscillator;
+    m_blockFill = blockFill;
+    m_blockPower = blockPower;
+    m_tracking = false;
+}
+
+qreal HumCanceller::mainsFrequency() const
+{
+    return m_omega * m_sampleRate / (2 * M_PI);
+}
+
+void HumCanceller::run(const qreal *input, qreal *output, int count)
+{
+    qreal c[Harmonics];
+    qreal s[Harmonics];
+    for (int start = 0; start < count; ) {
+        const int n = std::min(BlockSize - m_blockFill, count - start);
+        for (int i = start; i < start + n; ++i) {
+            const qreal x = input[i];
+            m_blockPower += x * x;
+            for (auto &d : m_detectors) {
+                auto &o = d.oscillator;
+                const qreal e = m_detectorStep * (x - d.a * o.c - d.b * o.s);
+                d.a += e * o.c;
+                d.b += e * o.s;
+                o.advance();
+            }
+
+            // Phasors of the harmonics by repeated rotation by the fundamental
+            c[0] = m_reference.c;
+            s[0] = m_reference.s;
+            qreal y = m_weights[0] * c[0] + m_weights[1] * s[0];
+            for (int k = 1; k < m_harmonics; ++k) {
+                c[k] = c[k - 1] * c[0] - s[k - 1] * s[0];
+                s[k] = s[k - 1] * c[0] + c[k - 1] * s[0];
+                y += m_weights[2 * k] * c[k] + m_weights[2 * k + 1] * s[k];
+            }
+            const qreal e = x - y;
+            const qreal step = m_step * e;
+            for (int k = 0; k < m_harmonics; ++k) {
+                m_weights[2 * k] += step * c[k];
+                m_weights[2 * k + 1] += step * s[k];
+            }
+            m_reference.advance();
+            if (output)
+                output[i] = e;
+        }
+        start += n;
+        m_blockFill += n;
+        if (m_blockFill == BlockSize)
+            endBlock();
+    }
+}
+
+void HumCanceller::endBlock()
+{
+    m_reference.normalise();
+    for (auto &d : m_detectors)
+        d.oscillator.normalise();
+    // A sinusoid of amplitude A has power A^2 / 2 and fits weights with
+    // a^2 + b^2 = A^2
+    const qreal threshold = 2 * MinimumHumShare * m_blockPower / BlockSize;
+    m_blockFill = 0;
+    m_blockPower = 0;
+
+    const qreal current = m_detectors[m_mains].power();
+    const qreal other = m_detectors[1 - m_mains].power();
+    if (other > threshold && other > SwitchRatio * current) {
+        if (++m_switchVotes >= m_votesNeeded) {
+            setMains(1 - m_mains);
+            return;
+        }
+    } else {
+        m_switchVotes = 0;
+    }
+
+    // The fundamental weights, as the phasor a - jb, rotate at the difference
+    // between the hum and reference frequencies
+    const qreal a = m_weights[0];
+    const qreal b = m_weights[1];
+    if (a * a + b * b > threshold) {
+        if (m_tracking) {
+            const qreal rotation = std::atan2(a * m_lastB - b * m_lastA, a * m_lastA + b * m_lastB);
+            const qreal nominal = 2 * M_PI * NominalFrequencies[m_mains] / m_sampleRate;
+            const qreal range = 2 * M_PI * MaximumDeviation / m_sampleRate;
+            const qreal gain = std::min(qreal(0.5) / BlockSize, TrackingGain * m_step);
+            m_omega = qBound(nominal - range, m_omega + gain * rotation, nominal + range);
+            m_reference.setStep(m_omega);
+        }
+        m_tracking = true;
+    } else {
+        m_tracking = false;
+    }
+    m_lastA = a;
+    m_lastB = b;
+}
+
+void HumCanceller::setMains(int index)
+{
+    m_mains = index;
+    const qreal highest = 0.45 * m_sampleRate / (NominalFrequencies[index] + MaximumDeviation);
+    m_harmonics = qBound(0, int(highest), int(Harmonics));
+    m_omega = 2 * M_PI * NominalFrequencies[index] / m_sampleRate;
+    m_reference.setStep(m_omega);
+    m_weights.fill(0);
+    m_tracking = false;
+    m_switchVotes = 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HUMCANCELLER_H
+#define HUMCANCELLER_H
+
+#include <QtGlobal>
+
+#include <array>
+
+/* Adaptive canceller of mains hum, applied to a stream of samples.
+ *
+ * The hum is modelled as a sum of the mains frequency and its first harmonics.
+ * A pair of least mean squares weights per harmonic fits a cosine and a sine
+ * of that frequency to the input and the fit is subtracted, which acts as a
+ * narrow notch that follows the amplitude and phase of the hum. The reference
+ * oscillator advances by a rotation per sample, so the cost per sample is a
+ * few multiply-adds per harmonic.
+ *
+ * Two more fundamental-only fits at 50 and 60 Hz detect the mains frequency
+ * and the canceller switches to the other one when it clearly dominates for a
+ * while. Within a range around the nominal frequency, the canceller follows
+ * drift of the mains by the rotation of its fundamental weights.
+ */
+class HumCanceller
+{
+public:
+    HumCanceller();
+
+    // Start over at the given rate, keeping the detected mains frequency
+    void setSampleRate(qreal sampleRate);
+    // Forget the hum estimates
+    void reset();
+    // Remove the hum from count samples in place, continuing from the
+    // current state
+    void process(qreal *samples, int count);
+    // Adapt to count samples without changing them, then rewind the
+    // oscillators, so that process() can run over the same samples with
+    // converged weights. Meant for the start of a stream.
+    void prime(const qreal *samples, int count);
+    // Tracked mains frequency in Hz
+    qreal mainsFrequency() const;
+
+    static const int Harmonics = 5;
+
+private:
+    // Unit phasor that advances by a fixed angle per sample
+    struct Oscillator
+    {
+        qreal c = 1;
+        qreal s = 0;
+        qreal stepC = 1;
+        qreal stepS = 0;
+        void setStep(qreal angle);
+        void advance();
+        void normalise();
+    };
+    // Fundamental-only fit at a nominal mains frequency
+    struct Detector
+    {
+        Oscillator oscillator;
+        qreal a = 0;
+        qreal b = 0;
+        qreal power() const { return a * a + b * b; }
+    };
+
+    void run(const qreal *input, qreal *output, int count);
+    void endBlock();
+    void setMains(int index);
+
+    qreal m_sampleRate;
+    qreal m_step;               // Adaptation step of the canceller
+    qreal m_detectorStep;
+    int m_mains;                // Index of the nominal frequency
+    int m_harmonics;            // Number of harmonics below Nyquist
+    qreal m_omega;              // Tracked fundamental in radians per sample
+    Oscillator m_reference;
+    std::array<qreal, 2 * Harmonics> m_weights; // Cosine and sine weight per harmonic
+    std::array<Detector, 2> m_detectors;
+    qreal m_lastA;              // Fundamental weights at the end of the last block
+    qreal m_lastB;
+    bool m_tracking;            // Whether the last weights were large enough to track
+    int m_blockFill;
+    qreal m_blockPower;         // Input power summed over the current block
+    int m_switchVotes;
+    int m_votesNeeded;
+};
+
+#endif // HUMCANCELLER_H
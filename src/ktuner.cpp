@@ -23,18 +23,24 @@
 #include "ktunerconfig.h"
 
 #include <QtMultimedia>
-#include <QAudioBuffer>
+#include <QGuiApplication>
 #include <QIODevice>
+#include <QScreen>
 #include <QXYSeries>
 
 using namespace QtCharts;
 
 namespace {
-    inline void replace(QXYSeries *series, const QVector<QVector<QPointF>> data, int &index)
+    // The charts ask for a spectrum and then for its peaks. They are
+    // converted to points only when asked for, with at most two points of the
+    // spectrum per pixel, so that the cost of drawing does not grow with the
+    // segment length.
+    inline void replace(QXYSeries *series, const Spectrum &spectrum, const QVector<Tone> &peaks,
+                        qreal from, qreal to, int width, int &index)
     {
         if (series) {
-            series->replace(data[index]);
-            ++index %= data.size();
+            series->replace(index == 0 ? spectrum.toPoints(from, to, width) : toPoints(peaks));
+            ++index %= 2;
         }
     }
 }
@@ -43,26 +49,65 @@ KTuner::KTuner(QObject* parent)
     : QObject(parent)
     , m_audio(nullptr)
     , m_device(nullptr)
-    , m_bufferPosition(0)
-    , m_analyzer(new Analyzer(this))
+    , m_segmentSize(0)
+    , m_hopSize(0)
+    , m_updateHopSize(0)
+    , m_nextSegmentEnd(0)
+    , m_nextFrameEnd(0)
+    , m_analyzer(new Analyzer)
     , m_result(new AnalysisResult(this))
+    , m_presentInterval(0)
+    , m_presentedFrames(0)
+    , m_coalescedFrames(0)
 {
+    qRegisterMetaType<Analyzer::Settings>();
+    m_analyzer->setFrameQueue(&m_queue);
+    m_analyzer->moveToThread(&m_analysisThread);
+    m_analysisThread.setObjectName(QStringLiteral("Analyzer"));
+    m_analysisThread.start();
+
+    // The analyzer only sees the configuration through these connections, so
+    // it never reads KTunerConfig from its own thread. It waits for frames in
+    // the queue rather than in its event loop, so each change also interrupts
+    // the wait.
+    connect(this, &KTuner::analyzerSettingsChanged, m_analyzer, &Analyzer::setSettings);
+    connect(this, &KTuner::analyzerSettingsChanged, this, [this] { m_queue.interrupt(); });
+    connect(KTunerConfig::self(), &KTunerConfig::noiseFilterChanged, m_analyzer, &Analyzer::setNoiseFilter);
+    connect(KTunerConfig::self(), &KTunerConfig::noiseFilterChanged, this, [this] { m_queue.interrupt(); });
+    connect(this, &KTuner::frameQueued, m_analyzer, &Analyzer::processQueue);
+    connect(m_analyzer, &Analyzer::segmentLengthChanged, this, &KTuner::onSegmentLengthChanged);
+    // The newest result is picked up once per display interval instead of
+    // being signalled, which would post an event to this thread per analysis
+    m_presentTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_presentTimer, &QTimer::timeout, this, &KTuner::presentFrame);
     loadConfig();
     connect(KTunerConfig::self(), &KTunerConfig::configChanged, this, &KTuner::loadConfig);
-    connect(m_analyzer, &Analyzer::done, this, &KTuner::processAnalysis);
 }
 
 KTuner::~KTuner()
 {
-    m_analyzer->deleteLater();
     m_audio->stop();
     m_audio->disconnect();
+    m_queue.abort();
+    m_analysisThread.quit();
+    m_analysisThread.wait();
+    delete m_analyzer;
 }
 
 void KTuner::loadConfig()
 {
-    m_segmentOverlap = KTunerConfig::segmentOverlap();
+    m_queue.setCapacity(KTunerConfig::queueLength());
+    // The audio input is read on this thread, which must never wait for the
+    // analyzer, so blocking falls back to dropping the oldest segment
+    const auto policy = FrameQueue::Policy(KTunerConfig::queuePolicy());
+    m_queue.setPolicy(policy == FrameQueue::Block ? FrameQueue::DropOldest : policy);
     m_pitchTable = PitchTable(KTunerConfig::a4(), KTunerConfig::pitchNotation());
+    qreal displayRate = KTunerConfig::maxDisplayRate();
+    const auto screen = QGuiApplication::primaryScreen();
+    if (screen && screen->refreshRate() > 0)
+        displayRate = std::min(displayRate, screen->refreshRate());
+    m_presentInterval = qRound(1000 / std::max<qreal>(displayRate, 1));
+    m_presentTimer.start(m_presentInterval);
 
     // Set up and verify the audio format we want
     m_format.setSampleRate(KTunerConfig::sampleRate());
@@ -71,10 +116,6 @@ void KTuner::loadConfig()
     m_format.setCodec("audio/pcm");
     m_format.setSampleType(QAudioFormat::SignedInt);
 
-    const auto bufferLength = KTunerConfig::segmentLength() * KTunerConfig::sampleSize() / 8;
-    m_buffer.fill(0, bufferLength);
-    m_bufferPosition = 0;
-
     QAudioDeviceInfo info = QAudioDeviceInfo::defaultInputDevice();
     for (const auto &i : QAudioDeviceInfo::availableDevices(QAudio::AudioInput))
         if (i.deviceName() == KTunerConfig::device()) {
@@ -92,6 +133,32 @@ void KTuner::loadConfig()
         m_audio->stop();
         m_audio->deleteLater();
     }
+    // The ring buffer must hold a full segment plus the hops of all queued
+    // segments and of the one being analysed, with room for the next hop
+    const int bytesPerSample = m_format.sampleSize() / 8;
+    m_segmentSize = KTunerConfig::segmentLength() * bytesPerSample;
+    setHopSize(KTunerConfig::segmentLength());
+    m_buffer.reset(new RingBuffer(m_segmentSize + (m_queue.capacity() + 2) * m_hopSize, m_format));
+    m_nextSegmentEnd = m_segmentSize;
+    m_nextFrameEnd = m_segmentSize;
+
+    Analyzer::Settings settings;
+    settings.sampleRate = m_format.sampleRate();
+    settings.segmentLength = KTunerConfig::segmentLength();
+    settings.numSpectra = KTunerConfig::numSpectra();
+    settings.windowFunction = KTunerConfig::windowFunction();
+    settings.precision = KTunerConfig::precision();
+    settings.averaging = KTunerConfig::averaging();
+    settings.enableNoiseFilter = KTunerConfig::enableNoiseFilter();
+    settings.fastUpdates = m_updateHopSize > 0;
+    settings.adaptiveLength = KTunerConfig::adaptiveSegmentLength();
+    settings.periodsPerSegment = KTunerConfig::periodsPerSegment();
+    settings.maxFrequency = KTunerConfig::decimateInput() ? KTunerConfig::highestFrequency() : 0;
+    settings.timeDomainFilter = KTunerConfig::timeDomainFilter();
+    settings.cancelHum = KTunerConfig::cancelMainsHum();
+    settings.segmentOverlap = KTunerConfig::segmentOverlap();
+    emit analyzerSettingsChanged(settings);
+
     m_audio = new QAudioInput(info, m_format, this);
     m_audio->setNotifyInterval(500); // in milliseconds
     m_device = m_audio->start();
@@ -99,44 +166,82 @@ void KTuner::loadConfig()
     connect(m_device, &QIODevice::readyRead, this, &KTuner::processAudioData);
 }
 
+void KTuner::setHopSize(quint32 segmentLength)
+{
+    const int bytesPerSample = m_format.sampleSize() / 8;
+    m_hopSize = segmentLength * bytesPerSample * (1 - KTunerConfig::segmentOverlap());
+    m_hopSize = std::max<qint64>(m_hopSize - m_hopSize % bytesPerSample, bytesPerSample);
+    // Fast updates only make sense between segments
+    m_updateHopSize = KTunerConfig::fastUpdateHop() * bytesPerSample;
+    if (m_updateHopSize >= m_hopSize)
+        m_updateHopSize = 0;
+}
+
+void KTuner::onSegmentLengthChanged(quint32 length)
+{
+    // Segments are still queued at the configured length, of which the
+    // analyzer uses the end, but they follow each other at the hop of the
+    // length it currently analyses. The next one is due within the new hop.
+    if (!m_buffer)
+        return;
+    setHopSize(length);
+    const quint64 next = m_buffer->writePosition() + m_hopSize;
+    m_nextSegmentEnd = std::max<quint64>(m_segmentSize, std::min(m_nextSegmentEnd, next));
+    m_nextFrameEnd = std::min(m_nextFrameEnd, m_nextSegmentEnd);
+}
+
 void KTuner::processAudioData()
 {
-    // Read into buffer and send when we have enough data
-    const qint64 bytesReady = m_audio->bytesReady();
-    const qint64 bytesAvailable = m_buffer.size() - m_bufferPosition;
-    const qint64 bytesToRead = std::min(bytesReady, bytesAvailable);
-    const qint64 bytesRead = m_device->read(m_buffer.data() + m_bufferPosition, bytesToRead);
-
-    m_bufferPosition += bytesRead;
-    if (m_bufferPosition == m_buffer.size()) {
-        m_analyzer->doAnalysis(QAudioBuffer(m_buffer, m_format));
-        // Keep the overlapping segment length in buffer and position at end
-        // for next read
-        qint64 overlap = m_buffer.size() * (1 - m_segmentOverlap);
-        overlap -= overlap % (m_format.sampleSize() / 8);
-        QBuffer m_bufferIO(&m_buffer);
-        m_bufferIO.open(QIODevice::ReadOnly);
-        m_bufferIO.seek(overlap);
-        const QByteArray temp = m_bufferIO.readAll();
-        m_bufferIO.close();
-        m_buffer.replace(0, temp.size(), temp);
-        m_bufferPosition = temp.size();
+    // Read directly into the ring buffer and queue a segment each time its
+    // end is reached. Consecutive segments overlap in the buffer, so the only
+    // cost per hop is queueing a reference to the new segment. With fast
+    // updates enabled, the latest segment is also queued every update hop in
+    // between, marked as an update.
+    qint64 bytesReady = m_audio->bytesReady();
+    while (bytesReady > 0) {
+        qint64 bytesToRead = std::min<qint64>(bytesReady, m_nextFrameEnd - m_buffer->writePosition());
+        char *data = m_buffer->writePointer(bytesToRead);
+        const qint64 bytesRead = m_device->read(data, bytesToRead);
+        if (bytesRead <= 0)
+            break;
+        m_buffer->commit(bytesRead);
+        bytesReady -= bytesRead;
+
+        if (m_buffer->writePosition() == m_nextFrameEnd) {
+            AudioFrame frame;
+            frame.buffer = m_buffer;
+            frame.position = m_nextFrameEnd - m_segmentSize;
+            frame.size = m_segmentSize;
+            frame.update = m_nextFrameEnd != m_nextSegmentEnd;
+            if (m_queue.push(frame))
+                emit frameQueued();
+            if (!frame.update)
+                m_nextSegmentEnd += m_hopSize;
+            m_nextFrameEnd = m_nextSegmentEnd;
+            if (m_updateHopSize > 0)
+                m_nextFrameEnd = std::min<quint64>(m_nextFrameEnd, m_buffer->writePosition() + m_updateHopSize);
+        }
     }
 }
 
-void KTuner::processAnalysis(const Spectrum harmonics, const Spectrum spectrum, const Spectrum autocorrelation, const Spectrum snacPeaks)
+void KTuner::presentFrame()
 {
-    // Prepare spectrum and harmonics for display as QXYSeries
-    m_seriesData.clear();
-    m_seriesData.append(spectrum);
-    m_seriesData.append(harmonics);
-    m_autocorrelationData.clear();
-    m_autocorrelationData.append(autocorrelation);
-    m_autocorrelationData.append(snacPeaks);
+    // Hold on to the latest frame for the charts. Frames published since the
+    // last one shown were coalesced, and there may be no new one yet.
+    const auto frame = m_analyzer->latestFrame();
+    if (!frame || frame == m_frame)
+        return;
+    if (m_frame)
+        m_coalescedFrames += frame->sequence() - m_frame->sequence() - 1;
+    m_frame = frame;
+    ++m_presentedFrames;
+    const auto &harmonics = frame->harmonics();
+    const auto &spectrum = frame->spectrum();
 
     qreal deviation = 0;
     qreal fundamental = 0;
-    const qreal maxAmplitude = std::max_element(spectrum.constBegin(), spectrum.constEnd())->amplitude;
+    const auto amplitudes = spectrum.constAmplitudes();
+    const qreal maxAmplitude = spectrum.isEmpty() ? 0 : *std::max_element(amplitudes, amplitudes + spectrum.size());
     Note newNote;
 
     if (!harmonics.isEmpty()) {
@@ -152,16 +257,24 @@ void KTuner::processAnalysis(const Spectrum harmonics, const Spectrum spectrum,
     emit newResult(m_result);
 }
 
-void KTuner::updateSpectrum(QXYSeries *series) const
+void KTuner::resetNoiseFilter()
+{
+    QMetaObject::invokeMethod(m_analyzer, "resetFilter", Qt::QueuedConnection);
+    m_queue.interrupt();
+}
+
+void KTuner::updateSpectrum(QXYSeries *series, qreal from, qreal to, int width) const
 {
     static int seriesIndex = 0;
-    replace(series, m_seriesData, seriesIndex);
+    if (m_frame)
+        replace(series, m_frame->spectrum(), m_frame->harmonics(), from, to, width, seriesIndex);
 }
 
-void KTuner::updateAutocorrelation(QXYSeries *series) const
+void KTuner::updateAutocorrelation(QXYSeries *series, qreal from, qreal to, int width) const
 {
     static int seriesIndex = 0;
-    replace(series, m_autocorrelationData, seriesIndex);
+    if (m_frame)
+        replace(series, m_frame->autocorrelation(), m_frame->snacPeaks(), from, to, width, seriesIndex);
 }
 
 void KTuner::onStateChanged(QAudio::State newState) const
@@ -20,19 +20,23 @@
 #ifndef KTUNER_H
 #define KTUNER_H
 
+#include "analysisframe.h"
+#include "analyzer.h"
+#include "framequeue.h"
 #include "note.h"
 #include "pitchtable.h"
+#include "ringbuffer.h"
 #include "spectrum.h"
 
 #include <QtGlobal>
 #include <QObject>
 #include <QAudio>
 #include <QAudioFormat>
-#include <QByteArray>
+#include <QSharedPointer>
 #include <QVector>
-#include <QPointF>
+#include <QThread>
+#include <QTimer>
 
-class Analyzer;
 class AnalysisResult;
 class QIODevice;
 class QAudioInput;
@@ -45,9 +49,14 @@ namespace QtCharts {
  * The tuner connects to the audio input and directs its Analyzer component to
  * find the fundamental frequency from the given samples. It then looks up this
  * frequency in a table of musical pitches to find the closest match and the
- * deviation from its exact pitch.
+ * deviation from its exact pitch. The analyzer runs in a separate thread and
+ * receives its input through a bounded FrameQueue.
  *
  * The results are made available via signals to allow the GUI to update itself.
+ * They are presented at most at the configured display rate, which is capped
+ * by the refresh rate of the screen, so that short segments do not make the
+ * GUI redraw more often than it can be seen. The tuner picks up the newest
+ * result once per interval, so results that arrive in between are coalesced.
  * A pointer to the analyzer itself is also available as a QML property to allow
  * the user to configure its properties.
  */
@@ -55,38 +64,66 @@ class KTuner : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(AnalysisResult* result READ result NOTIFY newResult)
+    Q_PROPERTY(quint64 processedFrames READ processedFrames NOTIFY newResult)
+    Q_PROPERTY(quint64 droppedFrames READ droppedFrames NOTIFY newResult)
+    Q_PROPERTY(quint64 presentedFrames READ presentedFrames NOTIFY newResult)
+    Q_PROPERTY(quint64 coalescedFrames READ coalescedFrames NOTIFY newResult)
 
 public:
     explicit KTuner(QObject* parent = 0);
     ~KTuner();
     Analyzer* analyzer() const { return m_analyzer; }
     AnalysisResult* result() const { return m_result; }
+    quint64 processedFrames() const { return m_queue.processedCount(); }
+    quint64 droppedFrames() const { return m_queue.droppedCount(); }
+    // Analysis results shown, and those replaced by a newer one before they
+    // could be shown
+    quint64 presentedFrames() const { return m_presentedFrames; }
+    quint64 coalescedFrames() const { return m_coalescedFrames; }
 
 signals:
     void newResult(AnalysisResult *result);
+    void frameQueued();
+    void analyzerSettingsChanged(const Analyzer::Settings &settings);
 
 public slots:
-    void updateSpectrum(QtCharts::QXYSeries *series) const;
-    void updateAutocorrelation(QtCharts::QXYSeries *series) const;
+    // Start the noise estimate of the analyzer over
+    void resetNoiseFilter();
+    // Show the current spectrum or autocorrelation and its peaks, reduced to
+    // the visible range of a chart this many pixels wide
+    void updateSpectrum(QtCharts::QXYSeries *series, qreal from, qreal to, int width) const;
+    void updateAutocorrelation(QtCharts::QXYSeries *series, qreal from, qreal to, int width) const;
 
 private slots:
     void loadConfig();
     void processAudioData();
-    void processAnalysis(const Spectrum harmonics, const Spectrum spectrum, const Spectrum autocorrelation, const Spectrum snacPeaks);
+    void presentFrame();
+    void onSegmentLengthChanged(quint32 length);
     void onStateChanged(QAudio::State newState) const;
 
 private:
+    // Set the hop sizes for segments of the given length
+    void setHopSize(quint32 segmentLength);
+
     QAudioFormat m_format;
     QAudioInput *m_audio;
     QIODevice *m_device;
-    QByteArray m_buffer;
-    int m_bufferPosition;
-    qreal m_segmentOverlap;
+    QSharedPointer<RingBuffer> m_buffer;
+    qint64 m_segmentSize;   // Bytes per queued segment
+    qint64 m_hopSize;       // Bytes between the ends of successive segments
+    qint64 m_updateHopSize; // Bytes between fast updates, 0 if disabled
+    quint64 m_nextSegmentEnd;
+    quint64 m_nextFrameEnd;
+    FrameQueue m_queue;
+    QThread m_analysisThread;
     Analyzer *m_analyzer;
     AnalysisResult *m_result;
     PitchTable m_pitchTable;
-    QVector<QVector<QPointF>> m_seriesData;
-    QVector<QVector<QPointF>> m_autocorrelationData;
+    SharedAnalysisFrame m_frame;    // Frame of the current result
+    QTimer m_presentTimer;
+    int m_presentInterval;  // Time between results, in ms
+    quint64 m_presentedFrames;
+    quint64 m_coalescedFrames;
 };
 
 #endif // KTUNER_H
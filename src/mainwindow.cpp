@@ -71,9 +71,6 @@ void MainWindow::handleAnalyzerState(Analyzer::State state)
     case Analyzer::Loading:
         message = i18n("Loading settings...");
         break;
-    case Analyzer::CalibratingFilter:
-        message = i18n("Calibrating noise filter...");
-        break;
     case Analyzer::Processing:
         message = i18n("Processing...");
         break;
@@ -81,7 +78,7 @@ void MainWindow::handleAnalyzerState(Analyzer::State state)
         return;
     }
     statusBar()->showMessage(message);
-    if (state == Analyzer::Loading || state == Analyzer::CalibratingFilter) {
+    if (state == Analyzer::Loading) {
         actionCollection()->action("calibrateNoiseFilter")->setDisabled(true);
         actionCollection()->action("enableNoiseFilter")->setDisabled(true);
     } else {
@@ -108,11 +105,11 @@ void MainWindow::setupActions()
     actionCollection()->addAction("showAutocorrelation", showAutocorrelation);
 
     QAction *calibrateNoiseFilter = new QAction(this);
-    calibrateNoiseFilter->setText(i18n("&Recalibrate Noise Filter"));
+    calibrateNoiseFilter->setText(i18n("&Reset Noise Filter"));
     calibrateNoiseFilter->setIcon(QIcon::fromTheme("chronometer-reset"));
     calibrateNoiseFilter->setEnabled(KTunerConfig::enableNoiseFilter());
     actionCollection()->addAction("calibrateNoiseFilter", calibrateNoiseFilter);
-    connect(calibrateNoiseFilter, &QAction::triggered, m_tuner->analyzer(), &Analyzer::resetFilter);
+    connect(calibrateNoiseFilter, &QAction::triggered, m_tuner, &KTuner::resetNoiseFilter);
 
     QAction *enableFilter = new QAction(this);
     enableFilter->setText(i18n("&Enable Noise Filter"));
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "noiseestimator.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+    // Smoothing of each bin between frames
+    const qreal Smoothing = 0.85;
+    // The window spans this many seconds, in this many subwindows
+    const qreal WindowDuration = 4;
+    const int Subwindows = 8;
+    // Ratio of the mean of the smoothed amplitudes of noise to their minimum
+    // over the window
+    const qreal Bias = 1.4;
+    const qreal Unset = std::numeric_limits<qreal>::max();
+}
+
+NoiseEstimator::NoiseEstimator()
+    : m_frames(0)
+    , m_subwindowLength(12)
+    , m_subwindowFill(0)
+    , m_nextSubwindow(0)
+{
+}
+
+void NoiseEstimator::reset(int size)
+{
+    m_smoothed.fill(0, size);
+    m_current.fill(Unset, size);
+    m_subwindows.fill(Unset, Subwindows * size);
+    m_window.fill(Unset, size);
+    m_frames = 0;
+    m_subwindowFill = 0;
+    m_nextSubwindow = 0;
+}
+
+void NoiseEstimator::reset(const qreal *estimate, int size)
+{
+    reset(size);
+    // Start as if the estimate had been the noise floor all along
+    for (int i = 0; i < size; ++i) {
+        m_smoothed[i] = estimate[i];
+        m_window[i] = estimate[i] / Bias;
+    }
+    std::copy(m_window.constBegin(), m_window.constEnd(), m_subwindows.begin());
+    m_nextSubwindow = 1;
+    m_frames = 1;
+}
+
+void NoiseEstimator::setFrameInterval(qreal seconds)
+{
+    if (seconds > 0)
+        m_subwindowLength = std::max(1, qRound(WindowDuration / (Subwindows * seconds)));
+}
+
+void NoiseEstimator::update(const float *amplitudes, qreal *noise)
+{
+    const int n = size();
+    qreal *p = m_smoothed.data();
+    qreal *current = m_current.data();
+    const qreal *window = m_window.constData();
+    // The first spectrum is the only information there is
+    const qreal alpha = m_frames == 0 ? 0 : Smoothing;
+    for (int i = 0; i < n; ++i) {
+        p[i] = alpha * p[i] + (1 - alpha) * amplitudes[i];
+        current[i] = std::min(current[i], p[i]);
+        noise[i] = Bias * std::min(window[i], current[i]);
+    }
+    ++m_frames;
+
+    if (++m_subwindowFill < m_subwindowLength)
+        return;
+    // Replace the oldest subwindow by the current one, which starts over
+    m_subwindowFill = 0;
+    std::copy(current, current + n, m_subwindows.begin() + m_nextSubwindow * n);
+    m_nextSubwindow = (m_nextSubwindow + 1) % Subwindows;
+    std::fill(current, current + n, Unset);
+    qreal *w = m_window.data();
+    const qreal *s = m_subwindows.constData();
+    std::copy(s, s + n, w);
+    for (int k = 1; k < Subwindows; ++k) {
+        s += n;
+        for (int i = 0; i < n; ++i)
+            w[i] = std::min(w[i], s[i]);
+    }
+}
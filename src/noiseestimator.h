@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NOISEESTIMATOR_H
+#define NOISEESTIMATOR_H
+
+#include <QtGlobal>
+#include <QVector>
+
+/* Running estimate of the background noise in a series of amplitude spectra,
+ * by minimum statistics.
+ *
+ * Each bin of the spectra is smoothed over time and the estimate is the
+ * minimum of the smoothed values over a window of recent frames, scaled up by
+ * the ratio of the mean of noise to its expected minimum. Notes come and go
+ * and decay, while the noise floor stays, so a window longer than a note
+ * sees the noise alone at some point.
+ *
+ * The window is divided into a few subwindows. Each frame only lowers the
+ * minimum of the current subwindow, and the window minimum is recomputed from
+ * the subwindow minima once per subwindow, so the cost per frame stays linear
+ * in the number of bins. The subwindows hold as many frames as fit in a fixed
+ * duration, so that the window spans the same few seconds at any frame rate.
+ */
+class NoiseEstimator
+{
+public:
+    NoiseEstimator();
+
+    // Forget all previous spectra
+    void reset(int size);
+    // Continue from a previous estimate, for example one resampled to bins
+    // of another spacing
+    void reset(const qreal *estimate, int size);
+    // Set the time between consecutive frames, which sizes the subwindows.
+    // Takes effect from the current subwindow on, keeping the estimate.
+    void setFrameInterval(qreal seconds);
+    // Add a spectrum of size() bins and write the updated estimate to noise
+    void update(const float *amplitudes, qreal *noise);
+    int size() const { return m_smoothed.size(); }
+    // Whether no spectrum or estimate was added since the last reset
+    bool isEmpty() const { return m_frames == 0; }
+
+private:
+    QVector<qreal> m_smoothed;
+    QVector<qreal> m_current;       // Minimum of the current subwindow
+    QVector<qreal> m_subwindows;    // Minima of the previous subwindows, one block of bins each
+    QVector<qreal> m_window;        // Minimum over all previous subwindows
+    int m_frames;                   // Frames added since the last reset
+    int m_subwindowLength;          // Frames per subwindow
+    int m_subwindowFill;
+    int m_nextSubwindow;
+};
+
+#endif // NOISEESTIMATOR_H
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "preprocess.h"
+
+#if defined(Q_CC_GNU) && !defined(Q_CC_CLANG) && !defined(Q_CC_INTEL) && Q_CC_GNU >= 600 \
+    && (defined(Q_PROCESSOR_X86_64) || defined(Q_PROCESSOR_X86_32)) && defined(Q_OS_LINUX)
+#  define SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#  define SIMD_CLONES
+#endif
+
+namespace {
+    // The sums are accumulated in the sample precision over blocks of this
+    // many samples, and in double precision across blocks
+    const int BlockSize = 1024;
+    // Independent partial sums, so that the summation can be vectorised
+    const int Lanes = 16;
+
+    template<typename S, typename T>
+    Q_ALWAYS_INLINE void convertKernel(const S *__restrict input, int count, int x0, T scale, T *__restrict output, Preprocess::Sums &sums)
+    {
+        const T factor = T(1) / scale;
+        for (int start = 0; start < count; start += BlockSize) {
+            const int n = count - start < BlockSize ? count - start : BlockSize;
+            const S *in = input + start;
+            T *out = output + start;
+            T sumY[Lanes] = {};
+            T sumXY[Lanes] = {};
+            int j = 0;
+            for (; j + Lanes <= n; j += Lanes) {
+                for (int l = 0; l < Lanes; ++l) {
+                    const T y = T(in[j + l]) * factor;
+                    out[j + l] = y;
+                    sumY[l] += y;
+                    sumXY[l] += T(j + l) * y;
+                }
+            }
+            T blockY = 0;
+            T blockXY = 0;
+            for (; j < n; ++j) {
+                const T y = T(in[j]) * factor;
+                out[j] = y;
+                blockY += y;
+                blockXY += T(j) * y;
+            }
+            for (int l = 0; l < Lanes; ++l) {
+                blockY += sumY[l];
+                blockXY += sumXY[l];
+            }
+            // The indices within the block are relative to its start
+            sums.y += blockY;
+            sums.xy += blockXY + double(x0 + start) * blockY;
+        }
+    }
+
+    template<typename T>
+    Q_ALWAYS_INLINE void detrendKernel(T *__restrict data, const T *__restrict window, int count, T a, T b)
+    {
+        for (int x = 0; x < count; ++x)
+            data[x] = window[x] * (data[x] - (a * T(x) + b));
+    }
+}
+
+// Function multiversioning does not apply to templates, so instantiate the
+// kernels in plain functions
+namespace PreprocessKernels {
+#define DEFINE_CONVERT(S, T) \
+    SIMD_CLONES void convert(const S *input, int count, int x0, T scale, T *output, Preprocess::Sums &sums) \
+    { \
+        convertKernel(input, count, x0, scale, output, sums); \
+    }
+#define DEFINE_DETREND(T) \
+    SIMD_CLONES void detrendAndWindow(T *data, const T *window, int count, T a, T b) \
+    { \
+        detrendKernel(data, window, count, a, b); \
+    }
+
+    DEFINE_CONVERT(quint8, float)
+    DEFINE_CONVERT(qint8, float)
+    DEFINE_CONVERT(qint16, float)
+    DEFINE_CONVERT(qint32, float)
+    DEFINE_CONVERT(qint64, float)
+    DEFINE_CONVERT(double, float)
+    DEFINE_CONVERT(quint8, double)
+    DEFINE_CONVERT(qint8, double)
+    DEFINE_CONVERT(qint16, double)
+    DEFINE_CONVERT(qint32, double)
+    DEFINE_CONVERT(qint64, double)
+    DEFINE_CONVERT(double, double)
+    DEFINE_DETREND(float)
+    DEFINE_DETREND(double)
+
+#undef DEFINE_CONVERT
+#undef DEFINE_DETREND
+}
+
+template<typename S, typename T>
+void Preprocess::convert(const S *input, int count, int x0, T scale, T *output, Sums &sums)
+{
+    PreprocessKernels::convert(input, count, x0, scale, output, sums);
+}
+
+template<typename T>
+void Preprocess::detrendAndWindow(T *data, const T *window, int count, T a, T b)
+{
+    PreprocessKernels::detrendAndWindow(data, window, count, a, b);
+}
+
+template void Preprocess::convert(const quint8 *, int, int, float, float *, Sums &);
+template void Preprocess::convert(const qint8 *, int, int, float, float *, Sums &);
+template void Preprocess::convert(const qint16 *, int, int, float, float *, Sums &);
+template void Preprocess::convert(const qint32 *, int, int, float, float *, Sums &);
+template void Preprocess::convert(const qint64 *, int, int, float, float *, Sums &);
+template void Preprocess::convert(const double *, int, int, float, float *, Sums &);
+template void Preprocess::convert(const quint8 *, int, int, double, double *, Sums &);
+template void Preprocess::convert(const qint8 *, int, int, double, double *, Sums &);
+template void Preprocess::convert(const qint16 *, int, int, double, double *, Sums &);
+template void Preprocess::convert(const qint32 *, int, int, double, double *, Sums &);
+template void Preprocess::convert(const qint64 *, int, int, double, double *, Sums &);
+template void Preprocess::convert(const double *, int, int, double, double *, Sums &);
+template void Preprocess::detrendAndWindow(float *, const float *, int, float, float);
+template void Preprocess::detrendAndWindow(double *, const double *, int, double, double);
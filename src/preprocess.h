@@ -0,0 +1,53 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <QtGlobal>
+
+/* Kernels of the analyzer's preprocessing, which converts raw samples to
+ * floating point and subtracts a linear least squares fit before applying the
+ * window function.
+ *
+ * Conversion and the sums needed for the fit happen in a single pass over the
+ * input, followed by one pass over the converted samples to subtract the fit
+ * and apply the window. The loops are written to be vectorised by the
+ * compiler; with GCC on x86 they are compiled for SSE2, AVX2 and AVX-512 and
+ * the best version for the CPU is chosen at run time.
+ */
+namespace Preprocess {
+    // Sums of y and x * y over the converted samples, x being the sample index
+    struct Sums
+    {
+        double y = 0;
+        double xy = 0;
+    };
+
+    // Store count samples divided by scale in output and add them to sums,
+    // the first sample having index x0. Besides the integer sample types, S
+    // may be double for input that was already converted.
+    template<typename S, typename T>
+    void convert(const S *input, int count, int x0, T scale, T *output, Sums &sums);
+    // Replace data[x] by window[x] * (data[x] - (a * x + b))
+    template<typename T>
+    void detrendAndWindow(T *data, const T *window, int count, T a, T b);
+}
+
+#endif // PREPROCESS_H
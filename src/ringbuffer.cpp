@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringbuffer.h"
+
+#include <algorithm>
+
+namespace {
+    inline int roundUpToPowerOfTwo(qint64 size)
+    {
+        int result = 1;
+        while (result < size)
+            result *= 2;
+        return result;
+    }
+}
+
+AudioView AudioView::last(qint64 bytes) const
+{
+    AudioView view = *this;
+    const qint64 skip = byteCount() - bytes;
+    if (skip <= 0)
+        return view;
+    if (skip < size[0]) {
+        view.data[0] += skip;
+        view.size[0] -= skip;
+    } else {
+        view.data[0] = data[1] + (skip - size[0]);
+        view.size[0] = bytes;
+        view.data[1] = nullptr;
+        view.size[1] = 0;
+    }
+    return view;
+}
+
+RingBuffer::RingBuffer(qint64 minimumCapacity, const QAudioFormat &format)
+    : m_data(roundUpToPowerOfTwo(minimumCapacity), 0)
+    , m_mask(m_data.size() - 1)
+    , m_format(format)
+    , m_written(0)
+    , m_reserved(0)
+{
+}
+
+char *RingBuffer::writePointer(qint64 &size)
+{
+    const auto position = m_written.load(std::memory_order_relaxed);
+    const auto offset = position & m_mask;
+    size = std::min<qint64>(size, capacity() - offset);
+
+    // Announce the region before touching it, so that readers of the data
+    // about to be overwritten can detect this
+    m_reserved.store(position + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return m_data.data() + offset;
+}
+
+void RingBuffer::commit(qint64 size)
+{
+    const auto position = m_written.load(std::memory_order_relaxed) + size;
+    m_reserved.store(position, std::memory_order_relaxed);
+    m_written.store(position, std::memory_order_release);
+}
+
+quint64 RingBuffer::writePosition() const
+{
+    return m_written.load(std::memory_order_acquire);
+}
+
+AudioView RingBuffer::view(quint64 position, qint64 size) const
+{
+    AudioView view;
+    view.format = m_format;
+    const auto offset = position & m_mask;
+    view.data[0] = m_data.constData() + offset;
+    view.size[0] = std::min<qint64>(size, capacity() - offset);
+    view.data[1] = m_data.constData();
+    view.size[1] = size - view.size[0];
+    return view;
+}
+
+bool RingBuffer::isIntact(quint64 position) const
+{
+    // Order all preceding reads of buffer data before the check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return m_reserved.load(std::memory_order_relaxed) <= position + capacity();
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ *
+ * This file is part of KTuner.
+ *
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QtGlobal>
+#include <QAudioFormat>
+#include <QByteArray>
+
+#include <atomic>
+
+/* Read-only view of raw audio samples. The samples may be split in two
+ * contiguous parts, as happens when reading across the end of a ring buffer.
+ */
+struct AudioView
+{
+    QAudioFormat format;
+    const char *data[2] = {nullptr, nullptr};
+    qint64 size[2] = {0, 0};
+
+    qint64 byteCount() const { return size[0] + size[1]; }
+    int sampleCount() const { return format.sampleSize() > 0 ? byteCount() / (format.sampleSize() / 8) : 0; }
+    // View of the last bytes of this view
+    AudioView last(qint64 bytes) const;
+};
+
+/* Ring buffer holding the audio stream, written directly by the audio device.
+ *
+ * The capacity is a power of two, so positions in the stream map to buffer
+ * offsets by masking. Positions count bytes written since the buffer was
+ * created and are never reset, which makes it possible to tell whether a
+ * given range is still present. The buffer has a single writer and does not
+ * lock: a reader obtains a view of a range, reads it, and then checks that the
+ * range was not overwritten in the meantime.
+ */
+class RingBuffer
+{
+public:
+    // Create a buffer of at least the given capacity (in bytes)
+    RingBuffer(qint64 minimumCapacity, const QAudioFormat &format);
+
+    qint64 capacity() const { return m_data.size(); }
+    const QAudioFormat &format() const { return m_format; }
+
+    // Writer side: obtain a contiguous region of at most size bytes at the
+    // write position, reducing size if the region would wrap around. Data
+    // written there is published by commit().
+    char *writePointer(qint64 &size);
+    void commit(qint64 size);
+    quint64 writePosition() const;
+
+    // Reader side: a view of size bytes starting at the given stream position
+    AudioView view(quint64 position, qint64 size) const;
+    // Whether the range starting at position is still intact. Call this after
+    // reading from a view to validate what was read.
+    bool isIntact(quint64 position) const;
+
+private:
+    QByteArray m_data;
+    const quint64 m_mask;
+    const QAudioFormat m_format;
+    std::atomic<quint64> m_written;     // End of committed data
+    std::atomic<quint64> m_reserved;    // End of the region being written
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "slidingdft.h"
+
+#include <math.h>
+#include <algorithm>
+
+SlidingDft::SlidingDft()
+    : m_head(0)
+{
+}
+
+void SlidingDft::setup(int length, const QVector<qreal> &frequencies)
+{
+    m_history.fill(0, length);
+    m_head = 0;
+    const int size = frequencies.size();
+    m_rotationRe.resize(size);
+    m_rotationIm.resize(size);
+    m_entryRe.resize(size);
+    m_entryIm.resize(size);
+    m_re.fill(0, size);
+    m_im.fill(0, size);
+    for (int i = 0; i < size; ++i) {
+        const qreal w = frequencies.at(i);
+        m_rotationRe[i] = std::cos(w);
+        m_rotationIm[i] = std::sin(w);
+        m_entryRe[i] = std::cos(w * (length - 1));
+        m_entryIm[i] = -std::sin(w * (length - 1));
+    }
+}
+
+void SlidingDft::reset(const qreal *window)
+{
+    const int n = length();
+    std::copy(window, window + n, m_history.begin());
+    m_head = 0;
+    for (int i = 0; i < size(); ++i) {
+        // Rotate a phasor by exp(-jw) per sample
+        const qreal cw = m_rotationRe.at(i);
+        const qreal sw = -m_rotationIm.at(i);
+        qreal pr = 1, pi = 0, re = 0, im = 0;
+        for (int m = 0; m < n; ++m) {
+            re += window[m] * pr;
+            im += window[m] * pi;
+            const qreal t = pr * cw - pi * sw;
+            pi = pr * sw + pi * cw;
+            pr = t;
+        }
+        m_re[i] = re;
+        m_im[i] = im;
+    }
+}
+
+void SlidingDft::push(const qreal *samples, int count)
+{
+    const int n = length();
+    if (n == 0)
+        return;
+    if (count >= n) {
+        reset(samples + count - n);
+        return;
+    }
+
+    // X <- exp(jw) (X - oldest) + exp(-jw(N - 1)) newest, written out to
+    // avoid the overhead of std::complex multiplication
+    const qreal *history = m_history.constData();
+    for (int i = 0; i < size(); ++i) {
+        const qreal rr = m_rotationRe.at(i), ri = m_rotationIm.at(i);
+        const qreal er = m_entryRe.at(i), ei = m_entryIm.at(i);
+        qreal re = m_re.at(i), im = m_im.at(i);
+        int h = m_head;
+        for (int j = 0; j < count; ++j) {
+            const qreal d = re - history[h];
+            re = rr * d - ri * im + er * samples[j];
+            im = ri * d + rr * im + ei * samples[j];
+            if (++h == n)
+                h = 0;
+        }
+        m_re[i] = re;
+        m_im[i] = im;
+    }
+
+    // The new samples replace the oldest ones
+    for (int j = 0; j < count; ++j) {
+        m_history[m_head] = samples[j];
+        if (++m_head == n)
+            m_head = 0;
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 Steven Franzen <sfranzen85@gmail.com>
+ * 
+ * This file is part of KTuner.
+ * 
+ * KTuner is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ * 
+ * KTuner is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ * 
+ * You should have received a copy of the GNU General Public License along with
+ * KTuner. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SLIDINGDFT_H
+#define SLIDINGDFT_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#include <complex>
+
+/* Discrete Fourier transform of the most recent samples of a stream,
+ * evaluated at a few frequencies only.
+ *
+ * Each pushed sample updates every tracked value by one complex
+ * multiply-add, so following the stream costs O(frequencies) per sample
+ * instead of a full transform per hop. The phase is referenced to the oldest
+ * sample in the window, as for an FFT of the window. Rounding errors
+ * accumulate slowly; reset() recomputes the values directly.
+ */
+class SlidingDft
+{
+public:
+    using creal = std::complex<qreal>;
+
+    SlidingDft();
+
+    // Track the given frequencies, in radians per sample, over windows of
+    // the given length. The window initially holds zeros.
+    void setup(int length, const QVector<qreal> &frequencies);
+    // Fill the window with length() samples and compute the values directly
+    void reset(const qreal *window);
+    // Append samples to the window, dropping as many of the oldest ones
+    void push(const qreal *samples, int count);
+
+    int length() const { return m_history.size(); }
+    int size() const { return m_re.size(); }
+    creal value(int i) const { return creal(m_re.at(i), m_im.at(i)); }
+
+private:
+    QVector<qreal> m_history;   // Ring buffer holding the window
+    int m_head;                 // Position of the oldest sample
+    // Per frequency: the rotation exp(jw) applied per sample, the factor
+    // exp(-jw(N - 1)) of an entering sample and the current value
+    QVector<qreal> m_rotationRe, m_rotationIm;
+    QVector<qreal> m_entryRe, m_entryIm;
+    QVector<qreal> m_re, m_im;
+};
+
+#endif // SLIDINGDFT_H
@@ -20,97 +20,221 @@
 #include "spectrum.h"
 
 #include <math.h>
+#include <algorithm>
+#include <utility>
 
-Spectrum::operator QVector<QPointF>() const
+template<typename T>
+void BasicSpectrum<T>::swap(BasicSpectrum &other)
+{
+    m_amplitudes.swap(other.m_amplitudes);
+    std::swap(m_binSpacing, other.m_binSpacing);
+    std::swap(m_offset, other.m_offset);
+}
+
+template<typename T>
+void BasicSpectrum<T>::copyFrom(const BasicSpectrum &other)
+{
+    m_amplitudes.resize(other.size());
+    std::copy(other.m_amplitudes.constBegin(), other.m_amplitudes.constEnd(), m_amplitudes.begin());
+    m_binSpacing = other.m_binSpacing;
+    m_offset = other.m_offset;
+}
+
+template<typename T>
+BasicSpectrum<T>::operator QVector<QPointF>() const
 {
     QVector<QPointF> result(size());
-    auto r = result.begin();
-    for (const auto &t : *this) {
-        *r = t;
-        ++r;
+    for (int i = 0; i < size(); ++i)
+        result[i] = QPointF(frequency(i), m_amplitudes.at(i));
+    return result;
+}
+
+template<typename T>
+QVector<QPointF> BasicSpectrum<T>::toPoints(qreal from, qreal to, int columns) const
+{
+    if (isEmpty() || columns < 1)
+        return QVector<QPointF>(*this);
+    const auto a = m_amplitudes.constData();
+    const int last = size() - 1;
+    const int first = qBound(0, int(std::floor((from - m_offset) / m_binSpacing)), last);
+    const int end = qBound(first, int(std::ceil((to - m_offset) / m_binSpacing)), last);
+    QVector<QPointF> result;
+    result.reserve(2 * columns + 3);
+    const auto append = [&](int i) { result << QPointF(frequency(i), a[i]); };
+
+    // The bins between the edges are divided evenly over the columns
+    const int inner = end - first - 1;
+    append(first);
+    if (inner <= 2 * columns) {
+        for (int i = first + 1; i < end; ++i)
+            append(i);
+    } else {
+        for (int c = 0; c < columns; ++c) {
+            const int begin = first + 1 + qint64(inner) * c / columns;
+            const int stop = first + 1 + qint64(inner) * (c + 1) / columns;
+            int low = begin;
+            int high = begin;
+            for (int i = begin + 1; i < stop; ++i) {
+                if (a[i] < a[low])
+                    low = i;
+                else if (a[i] > a[high])
+                    high = i;
+            }
+            append(std::min(low, high));
+            if (low != high)
+                append(std::max(low, high));
+        }
     }
+    if (end > first)
+        append(end);
+    if (last > end)
+        append(last);
     return result;
 }
 
-QVector<Spectrum::const_iterator> Spectrum::findPeaks(qreal minimum) const
+namespace {
+    // Bins of the smoothed derivative computed ahead of a range that does
+    // not start at the first bin. The smoothing is recursive, but the
+    // influence of earlier bins decays by a factor of three per bin.
+    const int SmoothingWarmUp = 16;
+}
+
+template<typename T>
+template<typename Visit>
+void BasicSpectrum<T>::scanPeaks(qreal &minimum, int first, int last, Visit visit) const
 {
-    QVector<Spectrum::const_iterator> peaks;
-    peaks.reserve(size());
-
-    // Compute central differences, smooth the result and locate the zero
-    // crossings
-    Spectrum derivative = computeDerivative();
-    derivative.smooth();
-    auto i = constBegin() + 1;
-    const auto dEnd = derivative.constEnd() - 1;
-    for (auto d = derivative.constBegin() + 1; d < dEnd; ++d, ++i) {
-        if (i->amplitude > minimum && isNegativeZeroCrossing(d))
-            peaks.append(i);
+    const int n = size();
+    if (last < 0 || last > n - 1)
+        last = n - 1;
+    first = std::max(first, 1);
+    if (n < 3 || first >= last)
+        return;
+
+    // Central differences of the amplitudes, one-sided ones at either end,
+    // smoothed by averaging each value with its smoothed predecessor and its
+    // successor. The derivative and its smoothing are computed along with the
+    // search, two bins ahead of it.
+    const T *a = constAmplitudes();
+    const qreal scale = 1 / m_binSpacing;
+    const auto derivative = [a, n, scale](int i) -> T {
+        if (i == n - 1)
+            return (a[n-1] - a[n-2]) * scale;
+        return (a[i+1] - a[i-1]) * (0.5 * scale);
+    };
+    const T third = 1.0 / 3;
+    const int start = std::max(0, first - 1 - SmoothingWarmUp);
+    T previous = start == 0 ? (a[1] - a[0]) * scale : derivative(start);
+    T next = derivative(start + 1);
+    for (int i = start + 1; i < first; ++i) {
+        const T current = next;
+        next = derivative(i + 1);
+        previous = (previous + (current + next)) * third;
     }
+    for (int i = first; i < last; ++i) {
+        const T current = next;
+        next = derivative(i + 1);
+        const T smoothed = (previous + (current + next)) * third;
+        if (a[i] > minimum && previous > 0 && (smoothed < 0 || qFuzzyIsNull(smoothed)) && !visit(i))
+            return;
+        previous = smoothed;
+    }
+}
+
+template<typename T>
+QVector<int> BasicSpectrum<T>::findPeaks(qreal minimum) const
+{
+    QVector<int> peaks;
+    peaks.reserve(size() / 2 + 1);
+    scanPeaks(minimum, 0, -1, [&](int i) {
+        peaks.append(i);
+        return true;
+    });
     return peaks;
 }
 
-QVector<Spectrum::const_iterator> Spectrum::findZeros(quint16 number) const
+template<typename T>
+int BasicSpectrum<T>::findPeaks(int *peaks, int capacity, qreal minimum, int first, int last) const
 {
-    QVector<Spectrum::const_iterator> zeros;
-    if (number == 0)
-        number = size();
-    zeros.reserve(number);
+    int count = 0;
+    if (capacity > 0) {
+        scanPeaks(minimum, first, last, [&](int i) {
+            peaks[count++] = i;
+            return count < capacity;
+        });
+    }
+    return count;
+}
 
-    int numFound = 0;
-    for (auto t = constBegin(); numFound <= number && t < constEnd(); ++t)
-        if (isNegativeZeroCrossing(t)) {
-            zeros << t;
-            numFound++;
+template<typename T>
+int BasicSpectrum<T>::findHighestPeaks(int *peaks, int capacity, qreal minimum, int first, int last) const
+{
+    // The peaks found so far form a heap with the lowest on top. Once it is
+    // full, only higher peaks can enter, so the lowest raises the minimum.
+    if (capacity <= 0)
+        return 0;
+    const T *a = constAmplitudes();
+    const auto higher = [a](int i, int j) { return a[i] > a[j]; };
+    int count = 0;
+    scanPeaks(minimum, first, last, [&](int i) {
+        if (count == capacity) {
+            std::pop_heap(peaks, peaks + count, higher);
+            --count;
         }
-    return zeros;
+        peaks[count++] = i;
+        std::push_heap(peaks, peaks + count, higher);
+        if (count == capacity)
+            minimum = std::max(minimum, qreal(a[peaks[0]]));
+        return true;
+    });
+    std::sort(peaks, peaks + count);
+    return count;
 }
 
-Spectrum Spectrum::computeDerivative() const
+template<typename T>
+QVector<int> BasicSpectrum<T>::findZeros(int number) const
 {
-    static Spectrum derivative;
-    derivative.resize(size());
-    const auto iBegin = constBegin();
-    const auto iEnd = constEnd();
-    const qreal dx = (iBegin + 1)->frequency;
-
-    // Use one-sided differences for the first and last values, and central
-    // differences for all others
-    derivative[0] = Tone(iBegin->frequency, ((iBegin + 1)->amplitude - iBegin->amplitude) / dx);
-    derivative[size()-1] = Tone(iEnd->frequency, (iEnd->amplitude - (iEnd - 1)->amplitude) / dx);
-    auto d = derivative.begin() + 1;
-    for (auto i = iBegin + 1; i < iEnd - 1; ++d, ++i) {
-        const qreal dy = (i + 1)->amplitude - (i - 1)->amplitude;
-        *d = Tone(i->frequency, 0.5 * dy / dx);
-    }
-    return derivative;
+    if (number == 0)
+        number = size();
+    QVector<int> zeros(number);
+    zeros.resize(findZeros(zeros.data(), number));
+    return zeros;
 }
 
-void Spectrum::smooth()
+template<typename T>
+int BasicSpectrum<T>::findZeros(int *zeros, int capacity) const
 {
-    const auto spectrumEnd = end() - 1;
-    for (auto s = begin() + 1; s < spectrumEnd; ++s)
-        s->amplitude = ((s - 1)->amplitude + s->amplitude + (s + 1)->amplitude) / 3;
+    // A crossing is detected at its second bin, so the first cannot be one
+    int count = 0;
+    for (int i = 1; count < capacity && i < size(); ++i)
+        if (isNegativeZeroCrossing(i))
+            zeros[count++] = i;
+    return count;
 }
 
-bool isNegativeZeroCrossing(Spectrum::const_iterator d)
+template<typename T>
+bool BasicSpectrum<T>::isNegativeZeroCrossing(int i) const
 {
-    return (d - 1)->amplitude > 0 && (d->amplitude < 0 || qFuzzyIsNull(d->amplitude));
+    const T *a = constAmplitudes();
+    return a[i-1] > 0 && (a[i] < 0 || qFuzzyIsNull(a[i]));
 }
 
-Tone quadraticInterpolation(Spectrum::const_iterator peak)
+template<typename T>
+Tone BasicSpectrum<T>::quadraticInterpolation(int peak) const
 {
-    const auto num = (peak-1)->amplitude - (peak+1)->amplitude;
-    const auto delta = 0.5 * num / ((peak-1)->amplitude - 2 * peak->amplitude + (peak+1)->amplitude);
-    const auto dx = peak->frequency - (peak-1)->frequency;
-    return Tone(peak->frequency + delta * dx, peak->amplitude - 0.25 * num * delta);
+    const T *a = constAmplitudes() + peak;
+    const qreal num = a[-1] - a[1];
+    const qreal delta = 0.5 * num / (a[-1] - 2 * a[0] + a[1]);
+    return Tone(frequency(peak) + delta * m_binSpacing, a[0] - 0.25 * num * delta);
 }
 
-// Is more accurate but returns NaN on negative input
-Tone quadraticLogInterpolation(Spectrum::const_iterator peak)
+template<typename T>
+Tone BasicSpectrum<T>::quadraticLogInterpolation(int peak) const
 {
-    const auto num = std::log10((peak-1)->amplitude / (peak+1)->amplitude);
-    const auto delta = 0.5 * num / std::log10((peak-1)->amplitude * (peak+1)->amplitude / std::pow(peak->amplitude, 2));
-    const auto dx = peak->frequency - (peak-1)->frequency;
-    return Tone(peak->frequency + delta * dx, peak->amplitude - 0.25 * num * delta);
+    const T *a = constAmplitudes() + peak;
+    const qreal num = std::log10(qreal(a[-1]) / a[1]);
+    const qreal delta = 0.5 * num / std::log10(qreal(a[-1]) * a[1] / std::pow(qreal(a[0]), 2));
+    return Tone(frequency(peak) + delta * m_binSpacing, a[0] - 0.25 * num * delta);
 }
+
+template class BasicSpectrum<double>;
+template class BasicSpectrum<float>;
@@ -25,24 +25,88 @@
 #include <QtGlobal>
 #include <QVector>
 #include <QPointF>
+#include <QMetaType>
 
-/**
- * @todo write docs
+/* Amplitudes sampled at equidistant frequencies.
+ *
+ * Only the amplitudes are stored, contiguously; the frequency of bin i is
+ * offset + i * binSpacing. Tone and QPointF views of the bins are provided for
+ * the charts and for code that deals in individual tones. The amplitude type
+ * is either qreal (Spectrum) or float (CompactSpectrum), the latter for bulk
+ * storage such as the averaging history.
  */
-class Spectrum : public QVector<Tone>
+template<typename T>
+class BasicSpectrum
 {
 public:
-    using QVector::QVector;
+    explicit BasicSpectrum(int size = 0, qreal binSpacing = 1, qreal offset = 0)
+        : m_amplitudes(size), m_binSpacing(binSpacing), m_offset(offset) {}
 
+    int size() const { return m_amplitudes.size(); }
+    bool isEmpty() const { return m_amplitudes.isEmpty(); }
+    void resize(int size) { m_amplitudes.resize(size); }
+    void fill(T amplitude) { m_amplitudes.fill(amplitude); }
+    void swap(BasicSpectrum &other);
+    // Copy the other spectrum into this one's own storage instead of sharing
+    // it, so that neither allocates when it changes next
+    void copyFrom(const BasicSpectrum &other);
+
+    qreal binSpacing() const { return m_binSpacing; }
+    qreal offset() const { return m_offset; }
+    void setBinSpacing(qreal binSpacing, qreal offset = 0) { m_binSpacing = binSpacing; m_offset = offset; }
+    qreal frequency(int i) const { return m_offset + i * m_binSpacing; }
+
+    T amplitude(int i) const { return m_amplitudes.at(i); }
+    T &operator[](int i) { return m_amplitudes[i]; }
+    T operator[](int i) const { return m_amplitudes.at(i); }
+    T *amplitudes() { return m_amplitudes.data(); }
+    const T *amplitudes() const { return m_amplitudes.constData(); }
+    const T *constAmplitudes() const { return m_amplitudes.constData(); }
+
+    Tone tone(int i) const { return Tone(frequency(i), m_amplitudes.at(i)); }
     operator QVector<QPointF>() const;
-    QVector<const_iterator> findPeaks(qreal minimum = 0) const;
-    QVector<const_iterator> findZeros(quint16 number = 0) const;
-    Spectrum computeDerivative() const;
-    void smooth();
+    // Points of the bins from frequency from to to for a chart that shows
+    // them in the given number of columns. Wider ranges keep only the lowest
+    // and highest bin of each column, in their order, so that the peaks are
+    // still drawn. The bins just outside the range and the last bin are
+    // included, so the line crosses the edges and the extent is known. No
+    // columns means all bins.
+    QVector<QPointF> toPoints(qreal from, qreal to, int columns) const;
+
+    // Peak and zero crossing searches return bin indices. A peak is a
+    // negative zero crossing of the smoothed derivative whose amplitude
+    // exceeds the minimum.
+    QVector<int> findPeaks(qreal minimum = 0) const;
+    // Write the peaks in bins first up to last, exclusive, to peaks in
+    // ascending order, stopping after capacity of them, and return their
+    // number. A negative last means up to the end.
+    int findPeaks(int *peaks, int capacity, qreal minimum = 0, int first = 0, int last = -1) const;
+    // The same search, keeping the capacity highest peaks of the range
+    int findHighestPeaks(int *peaks, int capacity, qreal minimum = 0, int first = 0, int last = -1) const;
+    QVector<int> findZeros(int number = 0) const;
+    // Write the first negative zero crossings, up to capacity of them, to
+    // zeros and return their number
+    int findZeros(int *zeros, int capacity) const;
+    bool isNegativeZeroCrossing(int i) const;
+    // Interpolate the peak at the given bin, which must not be the first or
+    // last one
+    Tone quadraticInterpolation(int peak) const;
+    // Is more accurate but returns NaN on negative input
+    Tone quadraticLogInterpolation(int peak) const;
+
+private:
+    // Pass each peak in the range to visit, in ascending order, until it
+    // returns false. Visit may raise the minimum as it goes.
+    template<typename Visit> void scanPeaks(qreal &minimum, int first, int last, Visit visit) const;
+
+    QVector<T> m_amplitudes;
+    qreal m_binSpacing;
+    qreal m_offset;
 };
 
-bool isNegativeZeroCrossing(Spectrum::const_iterator d);
-Tone quadraticInterpolation(Spectrum::const_iterator peak);
-Tone quadraticLogInterpolation(Spectrum::const_iterator peak);
+using Spectrum = BasicSpectrum<qreal>;
+using CompactSpectrum = BasicSpectrum<float>;
+
+Q_DECLARE_METATYPE(Spectrum)
 
 #endif // SPECTRUM_H
@@ -22,6 +22,8 @@
 
 #include <QtGlobal>
 #include <QPointF>
+#include <QMetaType>
+#include <QVector>
 
 struct Tone
 {
@@ -42,4 +44,16 @@ inline bool operator<(Tone t1, Tone t2) {
     return t1.amplitude < t2.amplitude;
 }
 
+// Points for the charts
+inline QVector<QPointF> toPoints(const QVector<Tone> &tones)
+{
+    QVector<QPointF> points;
+    points.reserve(tones.size());
+    for (const auto &t : tones)
+        points << t;
+    return points;
+}
+
+Q_DECLARE_METATYPE(Tone)
+
 #endif // TONE_H
@@ -60,7 +60,7 @@ Rectangle {
             target: tuner
             onNewResult: {
                 for (var i = 0; i < chart.count; ++i)
-                    tuner.updateAutocorrelation(chart.series(i));
+                    tuner.updateAutocorrelation(chart.series(i), axisX.min, axisX.max, chart.plotArea.width);
             }
         }
     }
@@ -66,7 +66,7 @@ Rectangle {
                 }
 
                 for (var i = 0; i < chart.count; ++i) {
-                    tuner.updateSpectrum(chart.series(i));
+                    tuner.updateSpectrum(chart.series(i), axisX.min, axisX.max, chart.plotArea.width);
                 }
             }
         }